@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+"""statfs benchmarks.
+
+Per-call latency distributions of the entry points, the per-call cost in
+tight loops, the per-mount cost of building records and the allocations
+they leave behind, on the real mount table (Linux only for the synthetic
+ones) and on synthetic tables fed through statfs.mount_source(), and the
+mountinfo parse throughput.  render() is compared with the same text
+formatted in Python from getfsstat(fields=...), and checked for one
+series per mount point on a table with stacked mounts.  The synthetic
+tables also carry smoke checks of iter_mounts() chunking, Poller
+record identity and the MNT_STALE counters kept across filtered calls.
+
+    gmake bench
+    python3 bench/bench.py --small 20 --large 10000 --seconds 0.5
+"""
+
+import argparse
+import gc
+import os
+import pathlib
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import statfs  # noqa: E402
+from fakemount import FakeMounts  # noqa: E402
+
+try:
+    import psutil
+except ImportError:
+    psutil = None
+
+FIELDS = ('f_mntonname', 'f_bavail', 'f_blocks')
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def measure(func, seconds, min_runs=5):
+    """Latencies in ns, sorted: runs func until `seconds` have passed."""
+    func()  # warm up
+    values = []
+    clock = time.perf_counter_ns
+    end = clock() + int(seconds * 1e9)
+    while len(values) < min_runs or clock() < end:
+        start = clock()
+        func()
+        values.append(clock() - start)
+    values.sort()
+    return values
+
+
+def allocations(func):
+    """Memory blocks still allocated by the result of one call."""
+    gc.collect()
+    before = sys.getallocatedblocks()
+    result = func()
+    after = sys.getallocatedblocks()
+    del result
+    return after - before
+
+
+def header(title):
+    print()
+    print(title)
+    print(f'{"case":<36} {"runs":>6} {"p50 us":>10} {"p90 us":>10} '
+          f'{"p99 us":>10} {"max us":>10} {"ns/mount":>10} {"blk/mount":>10}')
+
+
+def report(name, func, seconds, mounts=0):
+    values = measure(func, seconds)
+    row = (f'{name:<36} {len(values):>6} '
+           f'{percentile(values, 50) / 1e3:>10.1f} {percentile(values, 90) / 1e3:>10.1f} '
+           f'{percentile(values, 99) / 1e3:>10.1f} {values[-1] / 1e3:>10.1f}')
+    if mounts:
+        blocks = allocations(func)
+        row += f' {percentile(values, 50) / mounts:>10.0f} {blocks / mounts:>10.2f}'
+    print(row)
+
+
+RENDER_FIELDS = ('f_bsize', 'f_blocks', 'f_bfree', 'f_bavail', 'f_files', 'f_ffree')
+
+
+def label(value):
+    return value.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+def python_prometheus():
+    """render(format='prometheus') as an exporter would write it in Python."""
+    rows = statfs.getfsstat(fields=('f_mntonname', 'f_mntfromname', 'f_fstypename')
+                            + RENDER_FIELDS)
+    # one series per mount point: the last mount listed is the one on top
+    rows = list({r[0]: r for r in rows}.values())
+    keys = [f'{{mountpoint="{label(r[0])}",device="{label(r[1])}",fstype="{label(r[2])}"}}'
+            for r in rows]
+    lines = []
+    for i, name in enumerate(RENDER_FIELDS, 3):
+        lines.append(f'# TYPE statfs_{name} gauge')
+        lines.extend(f'statfs_{name}{key} {r[i]}' for key, r in zip(keys, rows))
+    return ('\n'.join(lines) + '\n').encode()
+
+
+def bench_calls(seconds):
+    header('single calls')
+    fd = os.open('/', os.O_RDONLY)
+    try:
+        report('os.statvfs', lambda: os.statvfs('/'), seconds)
+        report('statfs.statfs', lambda: statfs.statfs('/'), seconds)
+        report('statfs.statfs(lazy)', lambda: statfs.statfs('/', lazy=True), seconds)
+        report('statfs.statfs(fields)', lambda: statfs.statfs('/', fields=FIELDS), seconds)
+        report('statfs.statfs(timeout)', lambda: statfs.statfs('/', timeout=1.0), seconds)
+        report('statfs.fstatfs', lambda: statfs.fstatfs(fd), seconds)
+        if psutil:
+            report('psutil.disk_usage', lambda: psutil.disk_usage('/'), seconds)
+    finally:
+        os.close(fd)
+
+
+def bench_loop(seconds, loops=1000):
+    """ns per call over `loops` back-to-back calls: the entry point overhead."""
+    print()
+    print(f'tight loops of {loops} calls')
+    print(f'{"case":<36} {"runs":>6} {"ns/call":>10}')
+    fd = os.open('/', os.O_RDONLY)
+    path = pathlib.Path('/')
+    cases = [
+        ('os.statvfs', lambda: os.statvfs('/')),
+        ('statfs.statfs(str)', lambda: statfs.statfs('/')),
+        ('statfs.statfs(bytes)', lambda: statfs.statfs(b'/')),
+        ('statfs.statfs(PathLike)', lambda: statfs.statfs(path)),
+        ('statfs.statfs(lazy)', lambda: statfs.statfs('/', lazy=True)),
+        ('statfs.statfs(lazy, fields)',
+         lambda: statfs.statfs('/', lazy=True, fields=FIELDS)),
+        ('statfs.statfs(dir_fd)', lambda: statfs.statfs('.', dir_fd=fd)),
+        ('os.fstatvfs', lambda: os.fstatvfs(fd)),
+        ('statfs.fstatfs', lambda: statfs.fstatfs(fd)),
+        ('statfs.fstatfs(lazy)', lambda: statfs.fstatfs(fd, lazy=True)),
+    ]
+    try:
+        for name, func in cases:
+            def loop():
+                for _ in range(loops):
+                    func()
+            values = measure(loop, seconds)
+            print(f'{name:<36} {len(values):>6} {values[0] / loops:>10.0f}')
+    finally:
+        os.close(fd)
+
+
+def bench_table(title, mounts, seconds):
+    header(f'{title}: {mounts} mounts')
+    cases = [
+        ('getfsstat', lambda: statfs.getfsstat()),
+        ('getfsstat(lazy)', lambda: statfs.getfsstat(lazy=True)),
+        ('getfsstat(fields)', lambda: statfs.getfsstat(fields=FIELDS)),
+        ('getfsstat(as_buffer)', lambda: statfs.getfsstat(as_buffer=True)),
+        ('getfsstat(exclude_types)',
+         lambda: statfs.getfsstat(exclude_types=('tmpfs', 'proc', 'cgroup2', 'overlay'))),
+        ('getmntinfo', lambda: statfs.getmntinfo()),
+        # cached NOWAIT: no system call, the record builder alone
+        ('getmntinfo(cached)', lambda: statfs.getmntinfo(cached=True)),
+        ('getmntinfo(cached, lazy)', lambda: statfs.getmntinfo(cached=True, lazy=True)),
+        ('getmntinfo(cached, fields)',
+         lambda: statfs.getmntinfo(cached=True, fields=FIELDS)),
+        ('getmntinfo(cached, as_buffer)',
+         lambda: statfs.getmntinfo(cached=True, as_buffer=True)),
+        ('capacity(top=10)', lambda: statfs.capacity(top=10)),
+        ('render(prometheus)', lambda: statfs.render()),
+        ('render(ndjson)', lambda: statfs.render('ndjson')),
+        ('python prometheus', python_prometheus),
+    ]
+    for name, func in cases:
+        report(name, func, seconds, mounts)
+    poller = statfs.Poller()
+    report('Poller.poll', poller.poll, seconds, mounts)
+    if psutil and title == 'real table':
+        report('psutil.disk_partitions', lambda: psutil.disk_partitions(all=True),
+               seconds, mounts)
+
+
+def check_render(count):
+    """render() writes each series once, also over stacked mount points."""
+    with FakeMounts(count, stacked=True) as fake:
+        previous = statfs.mount_source(fake.path)
+        try:
+            points = {m.f_mntonname for m in statfs.getmntinfo()}
+            text = statfs.render().decode()
+        finally:
+            statfs.mount_source(previous)
+    # (family, mountpoint): the other labels may differ between stacked mounts
+    series = [line.split('",', 1)[0] for line in text.splitlines()
+              if not line.startswith('#')]
+    duplicates = len(series) - len(set(series))
+    assert duplicates == 0, f'render(): {duplicates} duplicate series'
+    assert len(series) == len(points) * len(RENDER_FIELDS), 'render(): series missing'
+    print(f'\nrender(): {count} mounts over {len(points)} mount points, '
+          f'{len(series)} series, no duplicates')
+
+
+def check_iter(count):
+    """iter_mounts() yields what getfsstat() returns, whatever the chunk."""
+    chunks = (1, 7, 64, count - 1, count, count + 1)
+    with FakeMounts(count, stacked=True) as fake:
+        filters = [{}, {'include_types': ('tmpfs',)}, {'exclude_types': ('tmpfs', 'proc')},
+                   {'path_prefix': os.path.join(fake.root, 'mnt')}]
+        previous = statfs.mount_source(fake.path)
+        try:
+            for kwargs in filters:
+                expected = [m.f_mntonname for m in statfs.getfsstat(**kwargs)]
+                for chunk in chunks:
+                    got = [m.f_mntonname for m in statfs.iter_mounts(chunk=chunk, **kwargs)]
+                    assert got == expected, f'iter_mounts(chunk={chunk}, {kwargs})'
+        finally:
+            statfs.mount_source(previous)
+    print(f'iter_mounts(): {len(filters)} filters x {len(chunks)} chunk sizes '
+          f'match getfsstat()')
+
+
+def check_poller(count):
+    """Poller keeps one record per mount across polls and table changes."""
+    with FakeMounts(count) as fake:
+        previous = statfs.mount_source(fake.path)
+        try:
+            poller = statfs.Poller()
+            records = poller.poll()
+            ids = {r.f_mntonname: id(r) for r in records}
+            seen = set(records)
+            assert poller.poll() is records, 'Poller.poll(): a new list'
+            assert [id(r) for r in records] == list(ids.values()), 'Poller: records rebuilt'
+            # drop every other mount but the root: the rest keep their records
+            with open(fake.path) as f:
+                lines = f.readlines()
+            with open(fake.path, 'w') as f:
+                f.writelines(lines[:1] + lines[1::2])
+            poller.poll()
+            assert len(records) == len(lines[:1] + lines[1::2]), 'Poller: table not reread'
+            assert all(id(r) == ids[r.f_mntonname] for r in records), 'Poller: records rebuilt'
+            assert all(r in seen for r in records), 'Poller: records hash by content'
+        finally:
+            statfs.mount_source(previous)
+    print(f'Poller: {len(records)} of {count} records kept across polls')
+
+
+def check_stale(count, attempts=50):
+    """Counters of MNT_STALE mounts survive a filtered call in between."""
+    stale = []
+    with FakeMounts(count) as fake:
+        previous = statfs.mount_source(fake.path)
+        try:
+            statfs.getfsstat()
+            for _ in range(attempts):
+                statfs.getfsstat(include_types=('tmpfs',))
+                # a deadline no statfs() call meets: some come back stale
+                stale = [m for m in statfs.getfsstat(deadline=1e-6)
+                         if m.f_flags & statfs.MNT_STALE and m.f_fstypename != 'tmpfs']
+                if stale:
+                    break
+        finally:
+            statfs.mount_source(previous)
+    if not stale:
+        print(f'MNT_STALE: no call outlived the deadline in {attempts} tries, skipped')
+        return
+    lost = sum(1 for m in stale if not m.f_blocks)
+    assert not lost, f'MNT_STALE: {lost} of {len(stale)} mounts lost their counters'
+    print(f'MNT_STALE: {len(stale)} stale mounts kept their counters over a filtered call')
+
+
+def bench_parse(title, path, seconds):
+    """mountinfo parse throughput, without the statfs() calls."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    lines = data.count(b'\n')
+    print()
+    print(f'parse {title}: {lines} lines, {len(data)} bytes')
+    print(f'{"case":<36} {"runs":>6} {"p50 us":>10} {"MB/s":>10} {"ns/line":>10}')
+    for name, simd in (('_parse_mountinfo', True), ('_parse_mountinfo(simd=False)', False)):
+        values = measure(lambda: statfs._parse_mountinfo(data, simd=simd), seconds)
+        p50 = percentile(values, 50)
+        print(f'{name:<36} {len(values):>6} {p50 / 1e3:>10.1f} '
+              f'{len(data) / p50 * 1e3:>10.1f} {p50 / max(lines, 1):>10.0f}')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--seconds', type=float, default=0.5,
+                        help='time spent on each case (default: 0.5)')
+    parser.add_argument('--small', type=int, default=20,
+                        help='mounts in the small synthetic table (default: 20)')
+    parser.add_argument('--large', type=int, default=10000,
+                        help='mounts in the large synthetic table (default: 10000)')
+    args = parser.parse_args()
+
+    print(f'statfs {getattr(statfs, "model", "?")}, Python {sys.version.split()[0]}'
+          f'{"" if psutil else ", psutil not installed"}')
+    bench_calls(args.seconds)
+    bench_loop(args.seconds)
+    bench_table('real table', len(statfs.getmntinfo()), args.seconds)
+
+    if not sys.platform.startswith('linux'):
+        print('\nsynthetic tables need the Linux backend, skipped')
+        return
+    bench_parse('real table', '/proc/self/mountinfo', args.seconds)
+    check_render(args.small)
+    check_iter(args.small)
+    check_poller(args.small)
+    check_stale(args.large)
+    for count in (args.small, args.large):
+        with FakeMounts(count) as fake:
+            previous = statfs.mount_source(fake.path)
+            try:
+                bench_table('synthetic', len(statfs.getmntinfo()), args.seconds)
+                bench_parse('synthetic', fake.path, args.seconds)
+            finally:
+                statfs.mount_source(previous)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Synthetic mount tables for statfs.mount_source().
+
+The table is a file in the /proc/self/mountinfo format whose mount
+points are plain directories, so statfs() on them works unprivileged.
+"""
+
+import os
+import shutil
+import tempfile
+
+# (fstype, source, options): roughly what a container host carries
+KINDS = [
+    ('ext4', '/dev/sda1', 'rw,relatime'),
+    ('tmpfs', 'tmpfs', 'rw,nosuid,nodev'),
+    ('overlay', 'overlay', 'rw,relatime'),
+    ('proc', 'proc', 'rw,nosuid,nodev,noexec,relatime'),
+    ('cgroup2', 'cgroup2', 'rw,nosuid,nodev,noexec,relatime'),
+    ('nfs4', 'server:/export', 'rw,relatime'),
+    ('xfs', '/dev/nvme0n1p2', 'ro,noatime'),
+]
+
+
+def escape(path):
+    return (path.replace('\\', '\\134').replace(' ', '\\040')
+            .replace('\t', '\\011').replace('\n', '\\012'))
+
+
+class FakeMounts:
+    """A temporary directory holding `count` mounts and their table.
+
+    With `stacked`, every tenth mount is mounted over the mount point
+    before it, as overmounts and container masks are on real hosts.
+    """
+
+    def __init__(self, count, stacked=False):
+        self.count = count
+        self.root = tempfile.mkdtemp(prefix='statfs-bench-')
+        self.path = os.path.join(self.root, 'mountinfo')
+        lines = ['1 0 8:1 / / rw,relatime - ext4 /dev/sda1 rw']
+        for i in range(1, count):
+            if stacked and i % 10 == 0:
+                parent = i          # the previous mount, same kind: same labels
+            else:
+                parent = 1
+                point = os.path.join(self.root, 'mnt', f'm{i:05d}')
+                os.makedirs(point)
+                fstype, source, options = KINDS[i % len(KINDS)]
+            lines.append(f'{i + 1} {parent} 0:{i % 4096} / {escape(point)} {options} '
+                         f'shared:{i} - {fstype} {source} rw')
+        with open(self.path, 'w') as fp:
+            fp.write('\n'.join(lines) + '\n')
+
+    def close(self):
+        shutil.rmtree(self.root, ignore_errors=True)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+        return False
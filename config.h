@@ -0,0 +1,71 @@
+#define COMPILE_LINUX    1
+#define HAVE_STATFS      1
+#define HAVE_FSTATFS     1
+#define HAVE_GETFSSTAT   1
+#define HAVE_GETMNTINFO  1
+#define HAVE_GETMNTINFO_R_NP 1
+
+#define MNT_WAIT                1
+#define MNT_DWAIT               MNT_WAIT
+#define MNT_NOWAIT              2
+
+#define MNT_RDONLY              ST_RDONLY
+#define MNT_SYNCHRONOUS         ST_SYNCHRONOUS
+#define MNT_NOEXEC              ST_NOEXEC
+#define MNT_NOSUID              ST_NOSUID
+#define MNT_NODEV               ST_NODEV
+#define MNT_NOATIME             ST_NOATIME
+#define MNT_NOSYMFOLLOW         0x2000
+
+#define MNT_NFS4ACLS            0
+#define MNT_UNION               0
+#define MNT_ASYNC               0
+#define MNT_CPROTECT            0
+#define MNT_EXRDONLY            0
+#define MNT_EXPORTED            0
+#define MNT_REMOVABLE           0
+#define MNT_DEFEXPORTED         0
+#define MNT_QUARANTINE          0
+#define MNT_EXPORTANON          0
+#define MNT_EXKERB              0
+#define MNT_LOCAL               0x100000
+#define MNT_STALE               0x200000
+#define MNT_QUOTA               0
+#define MNT_ROOTFS              0
+#define MNT_DOVOLFS             0
+#define MNT_USER                0
+#define MNT_UPDATE              0
+#define MNT_NOBLOCK             0
+#define MNT_DELEXPORT           0
+#define MNT_RELOAD              0
+#define MNT_FORCE               0
+#define MNT_DONTBROWSE          0
+#define MNT_SUIDDIR             0
+#define MNT_IGNORE_OWNERSHIP    0
+#define MNT_SOFTDEP             0
+#define MNT_AUTOMOUNTED         0
+#define MNT_JOURNALED           0
+#define MNT_IGNORE              0
+#define MNT_NOUSERXATTR         0
+#define MNT_DEFWRITE            0
+#define MNT_GJOURNAL            0
+#define MNT_NONBUSY             0
+#define MNT_MULTILABEL          0
+#define MNT_NOFOLLOW            0
+#define MNT_BYFSID              0
+#define MNT_ACLS                0
+#define MNT_EXPUBLIC            0
+#define MNT_NOCLUSTERR          0
+#define MNT_STRICTATIME         0
+#define MNT_NOCLUSTERW          0
+#define MNT_SUJ                 0
+#define MNT_VERIFIED            0
+#define MNT_UNTRUSTED           0
+#define MNT_NOCOVER             0
+#define MNT_EMPTYDIR            0
+#define MNT_EXTLS               0
+#define MNT_EXTLSCERT           0
+#define MNT_EXTLSCERTUSER       0
+#define MNT_RECURSE             0
+#define MNT_DEFERRED            0
+#define MNT_SNAPSHOT            0
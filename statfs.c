@@ -9,6 +9,12 @@
 #define PyVER_EQUAL(major, minor)  (PY_VERSION_HEX == PyVER_VALUE((major), (minor)))
 #define PyVER_NEWER(major, minor)  (PY_VERSION_HEX >= PyVER_VALUE((major), (minor)))
 
+/* per-object locks of free-threaded builds; no-ops before 3.13 */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#  define Py_BEGIN_CRITICAL_SECTION(op)  {
+#  define Py_END_CRITICAL_SECTION()      }
+#endif /* !Py_BEGIN_CRITICAL_SECTION */
+
 /*
  *
  */
@@ -28,7 +34,26 @@
  */
 
 #include <sys/param.h>
-#include <sys/mount.h>
+#include <sys/time.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef COMPILE_LINUX
+#  include <dirent.h>
+#  include <sys/epoll.h>
+#  include <sys/stat.h>
+#  include <sys/statvfs.h>
+#  include <sys/sysmacros.h>
+#  include <sys/vfs.h>
+#  if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#    include <immintrin.h>
+#    define LINUX_SCAN_X86 1
+#  endif
+#else  /* !LINUX */
+#  include <sys/mount.h>
+#  include <sys/event.h>
+#endif /* !LINUX */
 
 #ifndef FALSE
 #define FALSE (!!0)
@@ -37,8 +62,58 @@
 #define TRUE (!0)
 #endif
 
+#ifdef COMPILE_LINUX
+
+/*
+ * Linux has no getfsstat/getmntinfo and its struct statfs carries no
+ * names, so keep a BSD-like record and fill it from /proc/self/mountinfo.
+ */
+
+#define MFSNAMELEN  32
+#define MNAMELEN    1024
+
+#define LINUX_MOUNTINFO  "/proc/self/mountinfo"
+
+/* mount_source(): another file in the mountinfo format, for tests */
+static pthread_mutex_t linux_source_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *linux_source = NULL;
+
+typedef struct statfs_fsid {
+    int32_t val[2];
+} statfs_fsid_t;
+
+typedef struct statfs_linux {
+    uint64_t f_flags;
+    statfs_fsid_t f_fsid;
+    uint64_t f_type;
+    uint64_t f_namemax;
+
+    char f_fstypename[MFSNAMELEN];
+    char f_mntfromname[MNAMELEN];
+    char f_mntonname[MNAMELEN];
+
+    uint64_t f_iosize;
+    uint64_t f_bsize;
+    uint64_t f_blocks;
+    uint64_t f_bavail;
+    uint64_t f_bfree;
+
+    uint64_t f_ffree;
+    uint64_t f_files;
+
+    uint64_t f_frsize;  /* statvfs */
+    uint64_t f_favail;  /* statvfs */
+    uint64_t f_mntid;   /* mount ID of mountinfo and statx */
+
+    dev_t l_dev;  /* major:minor of mountinfo */
+} statfs_t;
+
+#else  /* !LINUX */
+
 typedef struct statfs statfs_t;
 
+#endif /* !LINUX */
+
 /*
  *
  */
@@ -85,415 +160,7939 @@ ModuleAddRelease(PyObject *module, const char *name, PyObject **value)
     return res;
 }
 
+/* a method that drops the GIL halfway, entered by one thread at a time */
+inline static int
+BusyEnter(int *pbusy, const char *name)
+{
+    int idle = FALSE;
+
+    if (__atomic_compare_exchange_n(pbusy, &idle, TRUE, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return TRUE;
+    PyErr_Format(PyExc_RuntimeError, "%s() already in progress", name);
+    return FALSE;
+}
+
+inline static void
+BusyLeave(int *pbusy)
+{
+    __atomic_store_n(pbusy, FALSE, __ATOMIC_RELEASE);
+}
+
 /*
- *
+ * Timed waits against CLOCK_MONOTONIC: a step of the wall clock neither
+ * fires a timeout early nor stretches it.  Darwin has no
+ * pthread_condattr_setclock() and waits for the time left instead.
  */
 
-#define STATFS_MEMBERS 31
+static double
+clock_monotonic(void)
+{
+    struct timespec now;
 
-static const char *statfs_member[STATFS_MEMBERS][2] = {
-    { "f_version",     "F" }, /* FBSD */
-    { "f_otype",       "d" }, /* DF32 */
-    { "f_oflags",      "d" }, /* DF32 */
-    { "f_flags",       "-" },
-    { "f_flags_ext",   "D" }, /* DF64 */
-    { "f_owner",       "-" },
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
 
-    { "f_fsid",        "-" },
-    { "f_type",        "-" },
-    { "f_fssubtype",   "D" }, /* DF64 */
-    { "f_namemax",     "F" }, /* FBSD */
+static void
+cond_init_monotonic(pthread_cond_t *cond)
+{
+#ifdef COMPILE_DARWIN
+    pthread_cond_init(cond, NULL);
+#else  /* !DARWIN */
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+#endif /* !DARWIN */
+}
 
-    { "f_fstypename",  "-" },
-    { "f_mntfromname", "-" },
-    { "f_mntonname",   "-" },
-    { "f_spare",       "F" }, /* FBSD */
-    { "f_charspare",   "F" }, /* FBSD */
+/* lock held; until clock_monotonic() reaches `at`: 0 or ETIMEDOUT */
+static int
+cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, double at)
+{
+    struct timespec ts;
 
-    { "f_iosize",      "-" },
-    { "f_bsize",       "-" },
-    { "f_blocks",      "-" },
-    { "f_bavail",      "-" },
-    { "f_bfree",       "-" },
+#ifdef COMPILE_DARWIN
+    if ((at -= clock_monotonic()) <= 0)
+        return ETIMEDOUT;
+#endif /* DARWIN */
+    ts.tv_sec = (time_t) at;
+    ts.tv_nsec = (long) ((at - (double) ts.tv_sec) * 1e9);
+    if (ts.tv_nsec > 999999999L)
+        ts.tv_nsec = 999999999L;
+#ifdef COMPILE_DARWIN
+    return pthread_cond_timedwait_relative_np(cond, lock, &ts);
+#else  /* !DARWIN */
+    return pthread_cond_timedwait(cond, lock, &ts);
+#endif /* !DARWIN */
+}
 
-    { "f_ffree",       "-" },
-    { "f_files",       "-" },
+/*
+ * include_types=, exclude_types=, require_flags=, exclude_flags= and
+ * path_prefix=: evaluated on the raw table, before any record is built.
+ * The names are known before the counters are read, so the table is
+ * pruned by them first and no statfs() is spent on a dropped mount.
+ */
 
-    { "f_syncwrites",  "F" }, /* FBSD */
-    { "f_asyncwrites", "F" }, /* FBSD */
-    { "f_syncreads",   "F" }, /* FBSD */
-    { "f_asyncreads",  "F" }, /* FBSD */
+typedef struct statfs_filter {
+    int active;
+    PyObject *include;        /* PySequence_Fast of str, or NULL */
+    PyObject *exclude;
+    const char **include_names;   /* NULL: no include_types= */
+    const char **exclude_names;
+    Py_ssize_t include_count;
+    Py_ssize_t exclude_count;
+    unsigned long long require_flags;
+    unsigned long long exclude_flags;
+    const char *prefix;
+    size_t prefix_len;
+} statfs_filter;
 
-    { "f_reserved",    "D" }, /* DF64 */
-    { "f_reserved1",   "d" }, /* DF32 */
-    { "f_reserved2",   "d" }, /* DF32 */
-    { "f_reserved3",   "d" }, /* DF32 */
-    { "f_reserved4",   "d" }, /* DF32 */
-};
+static int
+filter_type(const char *name, const char **names, Py_ssize_t count)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < count; ++i)
+        if (strcmp(name, names[i]) == 0)
+            return TRUE;
+    return FALSE;
+}
+
+/* by_flags FALSE: the names only, the flags may still change with the counters */
+static int
+filter_match(const statfs_filter *filter, const statfs_t *pmnt, int by_flags)
+{
+    const char *path = pmnt->f_mntonname;
+    uint64_t flags = (uint64_t) pmnt->f_flags;
 
-typedef struct statfs_args {
-    PyObject *version;     /* FBSD */
-    PyObject *otype;       /* DF32 */
-    PyObject *oflags;      /* DF32 */
-    PyObject *flags;
-    PyObject *flags_ext;   /* DF64 */
-    PyObject *owner;
+    if (by_flags && (flags & filter->require_flags) != filter->require_flags)
+        return FALSE;
+    if (by_flags && (flags & filter->exclude_flags))
+        return FALSE;
+    if (filter->include_names &&
+        !filter_type(pmnt->f_fstypename, filter->include_names, filter->include_count))
+        return FALSE;
+    if (filter->exclude_names &&
+        filter_type(pmnt->f_fstypename, filter->exclude_names, filter->exclude_count))
+        return FALSE;
+    if (filter->prefix && !(filter->prefix_len == 1 && filter->prefix[0] == '/'))
+    {
+        /* whole components only: "/mnt" matches "/mnt/a", not "/mnt2" */
+        if (strncmp(path, filter->prefix, filter->prefix_len) != 0)
+            return FALSE;
+        if (path[filter->prefix_len] != '\0' && path[filter->prefix_len] != '/')
+            return FALSE;
+    }
+    return TRUE;
+}
 
-    PyObject *fsid;
-    PyObject *type;
-    PyObject *fssubtype;   /* DF64 */
-    PyObject *namemax;     /* FBSD */
+/* compacts the table in place, returns the new count; filter may be NULL */
+static int
+filter_apply(const statfs_filter *filter, statfs_t *pbuf, int mcnt, int by_flags)
+{
+    int i = 0;
+    int n = 0;
 
-    PyObject *fstypename;
-    PyObject *mntfromname;
-    PyObject *mntonname;
-    PyObject *spare;       /* FBSD */
-    PyObject *charspare;   /* FBSD */
+    if (!filter || !filter->active)
+        return mcnt;
+    for (i = 0; i < mcnt; ++i)
+        if (filter_match(filter, pbuf + i, by_flags))
+        {
+            if (n != i)
+                memcpy(pbuf + n, pbuf + i, sizeof(statfs_t));
+            ++n;
+        }
+    return n;
+}
 
-    PyObject *iosize;
-    PyObject *bsize;
-    PyObject *blocks;
-    PyObject *bavail;
-    PyObject *bfree;
+/*
+ * A copy in one malloc() block, without the GIL or the Python objects:
+ * for a job, which may outlive its caller.  NULL with errno.
+ */
+static statfs_filter *
+filter_copy(const statfs_filter *filter)
+{
+    statfs_filter *pnew = NULL;
+    const char **names = NULL;
+    size_t size = sizeof(statfs_filter);
+    size_t len = 0;
+    char *text = NULL;
+    Py_ssize_t i = 0;
+
+    size += sizeof(char *) * (size_t) (filter->include_count + filter->exclude_count + 2);
+    for (i = 0; i < filter->include_count; ++i)
+        size += strlen(filter->include_names[i]) + 1;
+    for (i = 0; i < filter->exclude_count; ++i)
+        size += strlen(filter->exclude_names[i]) + 1;
+    if (filter->prefix)
+        size += filter->prefix_len + 1;
+    if (!(pnew = (statfs_filter *) malloc(size)))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *pnew = *filter;
+    pnew->include = NULL;
+    pnew->exclude = NULL;
+    names = (const char **) (pnew + 1);
+    text = (char *) (names + filter->include_count + filter->exclude_count + 2);
+    if (filter->include_names)
+    {
+        pnew->include_names = names;
+        for (i = 0; i < filter->include_count; ++i, text += len)
+        {
+            len = strlen(filter->include_names[i]) + 1;
+            *names++ = memcpy(text, filter->include_names[i], len);
+        }
+        *names++ = NULL;
+    }
+    if (filter->exclude_names)
+    {
+        pnew->exclude_names = names;
+        for (i = 0; i < filter->exclude_count; ++i, text += len)
+        {
+            len = strlen(filter->exclude_names[i]) + 1;
+            *names++ = memcpy(text, filter->exclude_names[i], len);
+        }
+        *names++ = NULL;
+    }
+    if (filter->prefix)
+    {
+        memcpy(text, filter->prefix, filter->prefix_len);
+        text[filter->prefix_len] = '\0';
+        pnew->prefix = text;
+    }
+    return pnew;
+}
 
-    PyObject *ffree;
-    PyObject *files;
+/*
+ * Linux: mount table from /proc/self/mountinfo
+ */
 
-    PyObject *syncwrites;  /* FBSD */
-    PyObject *asyncwrites; /* FBSD */
-    PyObject *syncreads;   /* FBSD */
-    PyObject *asyncreads;  /* FBSD */
+#ifdef COMPILE_LINUX
+
+#define LINUX_ST_VALID  0x0020
+
+static const struct {
+    const char *name;
+    uint64_t flag;
+} linux_mount_option[] = {
+    { "ro",          ST_RDONLY },
+    { "nosuid",      ST_NOSUID },
+    { "nodev",       ST_NODEV },
+    { "noexec",      ST_NOEXEC },
+    { "sync",        ST_SYNCHRONOUS },
+    { "noatime",     ST_NOATIME },
+    { "nodiratime",  ST_NODIRATIME },
+    { "relatime",    ST_RELATIME },
+    { "nosymfollow", MNT_NOSYMFOLLOW },
+    { NULL, 0 },
+};
 
-    PyObject *reserved;    /* DF64 */
-    PyObject *reserved1;   /* DF32 */
-    PyObject *reserved2;   /* DF32 */
-    PyObject *reserved3;   /* DF32 */
-    PyObject *reserved4;   /* DF32 */
+/* MNT_LOCAL is synthesized: set unless the type is a network filesystem */
+static const char *linux_network_types[] = {
+    "nfs", "nfs4", "cifs", "smb3", "smbfs", "ncpfs", "ceph", "9p", "afs",
+    "coda", "glusterfs", "lustre", "gfs2", "ocfs2", "davfs", "fuse.sshfs",
+    "fuse.s3fs", "fuse.rclone", "fuse.glusterfs",
+    NULL,
+};
 
-    PyObject *fsidv[2];
-    PyObject *reservedv[8];
-    PyObject *reserved2v[2];
-    PyObject *reserved4v[4];
+static int
+linux_network_fs(const char *fstype)
+{
+    int i;
 
-} statfs_args;
-
-static PyObject *new_statfs_func = NULL;
-
-static void
-statfs_init(statfs_args *o)
-{
-    int i;
-
-    o->version = NULL;
-    o->otype = NULL;
-    o->oflags = NULL;
-    o->flags = NULL;
-    o->flags_ext = NULL;
-    o->owner = NULL;
+    for (i = 0; linux_network_types[i]; ++i)
+        if (linux_network_types[i][0] == fstype[0] &&
+            strcmp(fstype, linux_network_types[i]) == 0)
+            return TRUE;
+    return FALSE;
+}
 
-    o->fsid = NULL;
-    o->type = NULL;
-    o->fssubtype = NULL;
-    o->namemax = NULL;
+static void
+linux_unescape(char *s)
+{
+    char *d = s;
 
-    o->fstypename = NULL;
-    o->mntfromname = NULL;
-    o->mntonname = NULL;
-    o->spare = NULL;
-    o->charspare = NULL;
-
-    o->iosize = NULL;
-    o->bsize = NULL;
-    o->blocks = NULL;
-    o->bavail = NULL;
-    o->bfree = NULL;
-
-    o->ffree = NULL;
-    o->files = NULL;
-
-    o->syncwrites = NULL;
-    o->asyncwrites = NULL;
-    o->syncreads = NULL;
-    o->asyncreads = NULL;
+    /* mountinfo escapes ' ', '\t', '\n' and '\\' as "\ooo" */
+    while (*s)
+    {
+        if (s[0] == '\\' &&
+            s[1] >= '0' && s[1] <= '3' &&
+            s[2] >= '0' && s[2] <= '7' &&
+            s[3] >= '0' && s[3] <= '7')
+        {
+            *d++ = (char) (((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0'));
+            s += 4;
+        }
+        else
+            *d++ = *s++;
+    }
+    *d = '\0';
+}
 
-    o->reserved = NULL;
-    o->reserved1 = NULL;
-    o->reserved2 = NULL;
-    o->reserved3 = NULL;
-    o->reserved4 = NULL;
+static void
+linux_copy_name(char *dst, size_t size, const char *src)
+{
+    size_t len = strlen(src);
 
-    for (i = 0; i < 2; ++i)
-        o->fsidv[i] = NULL;
-    for (i = 0; i < 8; ++i)
-        o->reservedv[i] = NULL;
-    for (i = 0; i < 2; ++i)
-        o->reserved2v[i] = NULL;
-    for (i = 0; i < 4; ++i)
-        o->reserved4v[i] = NULL;
+    if (len >= size)
+        len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
 }
-
-static void
-statfs_exit(statfs_args *o)
+
+static uint64_t
+linux_mount_flags(char *opts)
 {
+    uint64_t flags = 0;
+    const char *name;
+    char *next;
     int i;
 
-    Py_XDECREF(o->version);
-    Py_XDECREF(o->otype);
-    Py_XDECREF(o->oflags);
-    Py_XDECREF(o->flags);
-    Py_XDECREF(o->flags_ext);
-    Py_XDECREF(o->owner);
+    /* a first-character test turns most of the compares away */
+    for (; opts; opts = next)
+    {
+        if ((next = strchr(opts, ',')))
+            *next++ = '\0';
+        for (i = 0; (name = linux_mount_option[i].name); ++i)
+            if (name[0] == opts[0] && strcmp(opts, name) == 0)
+            {
+                flags |= linux_mount_option[i].flag;
+                break;
+            }
+    }
+    return flags;
+}
+
+/*
+ * mountinfo scanner: the next ' ' or '\n' from p (end if none), and
+ * whether a backslash (an escape) came before it.  Vectorized where the
+ * target allows; AVX2 is picked at init when the CPU has it.
+ */
 
-    Py_XDECREF(o->fsid);
-    Py_XDECREF(o->type);
-    Py_XDECREF(o->fssubtype);
-    Py_XDECREF(o->namemax);
+typedef char *(*linux_scan_fn)(char *p, char *end, int *escaped);
 
-    Py_XDECREF(o->fstypename);
-    Py_XDECREF(o->mntfromname);
-    Py_XDECREF(o->mntonname);
-    Py_XDECREF(o->spare);
-    Py_XDECREF(o->charspare);
+static char *
+linux_scan_scalar(char *p, char *end, int *escaped)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == ' ' || *p == '\n')
+            return p;
+        if (*p == '\\')
+            *escaped = TRUE;
+    }
+    return end;
+}
 
-    Py_XDECREF(o->iosize);
-    Py_XDECREF(o->bsize);
-    Py_XDECREF(o->blocks);
-    Py_XDECREF(o->bavail);
-    Py_XDECREF(o->bfree);
+#ifdef LINUX_SCAN_X86
 
-    Py_XDECREF(o->ffree);
-    Py_XDECREF(o->files);
+static char *
+linux_scan_sse2(char *p, char *end, int *escaped)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    __m128i v;
+    unsigned int sep = 0;
+    unsigned int esc = 0;
+
+    while (end - p >= 16)
+    {
+        v = _mm_loadu_si128((const __m128i *) p);
+        sep = (unsigned int) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                                            _mm_cmpeq_epi8(v, newline)));
+        esc = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash));
+        if (sep)
+        {
+            sep = (unsigned int) __builtin_ctz(sep);
+            if (esc & ((1u << sep) - 1))
+                *escaped = TRUE;
+            return p + sep;
+        }
+        if (esc)
+            *escaped = TRUE;
+        p += 16;
+    }
+    return linux_scan_scalar(p, end, escaped);
+}
 
-    Py_XDECREF(o->syncwrites);
-    Py_XDECREF(o->asyncwrites);
-    Py_XDECREF(o->syncreads);
-    Py_XDECREF(o->asyncreads);
+__attribute__((target("avx2")))
+static char *
+linux_scan_avx2(char *p, char *end, int *escaped)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    __m256i v;
+    uint32_t sep = 0;
+    uint32_t esc = 0;
+
+    while (end - p >= 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        sep = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                                              _mm256_cmpeq_epi8(v, newline)));
+        esc = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash));
+        if (sep)
+        {
+            sep = (uint32_t) __builtin_ctz(sep);
+            if (esc & ((1u << sep) - 1))
+                *escaped = TRUE;
+            return p + sep;
+        }
+        if (esc)
+            *escaped = TRUE;
+        p += 32;
+    }
+    return linux_scan_sse2(p, end, escaped);
+}
 
-    Py_XDECREF(o->reserved);
-    Py_XDECREF(o->reserved1);
-    Py_XDECREF(o->reserved2);
-    Py_XDECREF(o->reserved3);
-    Py_XDECREF(o->reserved4);
+static linux_scan_fn linux_scan = linux_scan_sse2;
 
-    for (i = 0; i < 2; ++i)
-        Py_XDECREF(o->fsidv[i]);
-    for (i = 0; i < 8; ++i)
-        Py_XDECREF(o->reservedv[i]);
-    for (i = 0; i < 2; ++i)
-        Py_XDECREF(o->reserved2v[i]);
-    for (i = 0; i < 4; ++i)
-        Py_XDECREF(o->reserved4v[i]);
-}
-
-static void
-statfs_fix(statfs_args *o)
-{
-#define statfs_fix_none(n) if (!o->n) o->n = NewNone()
-
-    /* FBSD */
-    statfs_fix_none(version);
-    statfs_fix_none(namemax);
-    statfs_fix_none(spare);
-    statfs_fix_none(charspare);
-    statfs_fix_none(syncwrites);
-    statfs_fix_none(asyncwrites);
-    statfs_fix_none(syncreads);
-    statfs_fix_none(asyncreads);
+#else  /* !LINUX_SCAN_X86 */
 
-    /* DF32 */
-    statfs_fix_none(otype);
-    statfs_fix_none(oflags);
-    statfs_fix_none(reserved1);
-    statfs_fix_none(reserved2);
-    statfs_fix_none(reserved3);
-    statfs_fix_none(reserved4);
+static linux_scan_fn linux_scan = linux_scan_scalar;
 
-    /* DF64 */
-    statfs_fix_none(flags_ext);
-    statfs_fix_none(fssubtype);
-    statfs_fix_none(reserved);
+#endif /* !LINUX_SCAN_X86 */
 
-#undef statfs_fix_none
+static void
+linux_scan_init(void)
+{
+#ifdef LINUX_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        linux_scan = linux_scan_avx2;
+#endif /* LINUX_SCAN_X86 */
 }
 
-static PyObject *
-build_statfs(statfs_t *pmnt)
+static unsigned int
+linux_parse_uint(const char *s, const char **pend)
 {
-    statfs_args sa;
-    statfs_args *o = &sa;
-    PyObject *pinfo = NULL;
-    PyObject *args = NULL;
-    int i = 0;
+    unsigned int n = 0;
 
-#ifdef USE_STATFS_DF64
-    int rcnt = 0;
-#endif /* USE_STATFS_DF64 */
+    for (; *s >= '0' && *s <= '9'; ++s)
+        n = n * 10 + (unsigned int) (*s - '0');
+    *pend = s;
+    return n;
+}
+
+#define LINUX_FIELD_FSTYPE  6
+#define LINUX_FIELD_SOURCE  7
+#define LINUX_FIELDS        8
+
+/*
+ * "36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw"
+ *
+ * One line from p, split in place.  Returns the start of the next line;
+ * *pok tells whether pmnt was filled.
+ */
+static char *
+linux_parse_line(char *p, char *end, statfs_t *pmnt, linux_scan_fn scan, int *pok)
+{
+    char *field[LINUX_FIELDS];
+    int escaped[LINUX_FIELDS];
+    const char *num = NULL;
+    unsigned int mntid = 0;
+    unsigned int major = 0;
+    unsigned int minor = 0;
+    char *q = NULL;
+    int dash = FALSE;
+    int last = FALSE;
+    int esc = FALSE;
+    int n = 0;
+
+    *pok = FALSE;
+    do
+    {
+        esc = FALSE;
+        q = scan(p, end, &esc);
+        last = (q >= end || *q == '\n');
+        if (q < end)
+            *q = '\0';
+        if (n < LINUX_FIELD_FSTYPE || (dash && n < LINUX_FIELDS))
+        {
+            field[n] = p;
+            escaped[n++] = esc;
+        }
+        else if (!dash && p[0] == '-' && p[1] == '\0')
+            dash = TRUE; /* the end of the optional fields */
+        p = (q < end) ? q + 1 : end;
+    } while (!last);
+
+    if (n < LINUX_FIELDS)
+        return p;
+    mntid = linux_parse_uint(field[0], &num);
+    major = linux_parse_uint(field[2], &num);
+    if (*num != ':')
+        return p;
+    minor = linux_parse_uint(num + 1, &num);
+
+    /* mountinfo escapes ' ', '\t', '\n' and '\\': decode only those fields */
+    if (escaped[4])
+        linux_unescape(field[4]);
+    if (escaped[LINUX_FIELD_FSTYPE])
+        linux_unescape(field[LINUX_FIELD_FSTYPE]);
+    if (escaped[LINUX_FIELD_SOURCE])
+        linux_unescape(field[LINUX_FIELD_SOURCE]);
+
+    memset(pmnt, 0, sizeof(*pmnt));
+    linux_copy_name(pmnt->f_fstypename, sizeof(pmnt->f_fstypename), field[LINUX_FIELD_FSTYPE]);
+    linux_copy_name(pmnt->f_mntfromname, sizeof(pmnt->f_mntfromname), field[LINUX_FIELD_SOURCE]);
+    linux_copy_name(pmnt->f_mntonname, sizeof(pmnt->f_mntonname), field[4]);
+    pmnt->f_flags = linux_mount_flags(field[5]);
+    if (!linux_network_fs(field[LINUX_FIELD_FSTYPE]))
+        pmnt->f_flags |= MNT_LOCAL;
+    pmnt->f_mntid = mntid;
+    pmnt->l_dev = makedev(major, minor);
+    *pok = TRUE;
+    return p;
+}
+
+static void
+linux_set_counters(statfs_t *pmnt, const struct statfs *psfs)
+{
+    pmnt->f_flags = ((uint64_t) psfs->f_flags & ~(uint64_t) LINUX_ST_VALID) |
+                    (pmnt->f_flags & MNT_LOCAL);
+    pmnt->f_fsid.val[0] = psfs->f_fsid.__val[0];
+    pmnt->f_fsid.val[1] = psfs->f_fsid.__val[1];
+    pmnt->f_type = (uint64_t) psfs->f_type;
+    pmnt->f_namemax = (uint64_t) psfs->f_namelen;
+
+    /* BSD: f_bsize is the unit of the counters, f_iosize the transfer size */
+    pmnt->f_iosize = (uint64_t) psfs->f_bsize;
+    pmnt->f_bsize = (uint64_t) (psfs->f_frsize ? psfs->f_frsize : psfs->f_bsize);
+    pmnt->f_blocks = (uint64_t) psfs->f_blocks;
+    pmnt->f_bavail = (uint64_t) psfs->f_bavail;
+    pmnt->f_bfree = (uint64_t) psfs->f_bfree;
+
+    pmnt->f_ffree = (uint64_t) psfs->f_ffree;
+    pmnt->f_files = (uint64_t) psfs->f_files;
+
+    /* statvfs(): Linux keeps no inodes back from unprivileged users */
+    pmnt->f_frsize = pmnt->f_bsize;
+    pmnt->f_favail = pmnt->f_ffree;
+}
+
+/* source: a mountinfo file, NULL for ours */
+static int
+linux_open_fd(const char *source)
+{
+    int fd = -1;
+
+    if (source)
+        return open(source, O_RDONLY | O_CLOEXEC);
+    pthread_mutex_lock(&linux_source_lock);
+    fd = open(linux_source ? linux_source : LINUX_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+    pthread_mutex_unlock(&linux_source_lock);
+    return fd;
+}
+
+/*
+ * The whole file in large read()s into a new NUL-terminated buffer;
+ * procfs hands mountinfo out a page or so per read().  The buffer starts
+ * at the size of the last read, so a large table is not regrown each time.
+ */
+#define LINUX_TEXT_MIN  (64 * 1024)
+
+static size_t linux_text_hint = LINUX_TEXT_MIN;
+
+static ssize_t
+linux_read_text(int fd, char **ptext)
+{
+    char *text = NULL;
+    char *pnew = NULL;
+    size_t cap = 0;
+    size_t size = 0;
+    ssize_t rc = 0;
+
+    *ptext = NULL;
+    cap = __atomic_load_n(&linux_text_hint, __ATOMIC_RELAXED);
+    if (!(text = (char *) malloc(cap)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (;;)
+    {
+        if (size + 1 >= cap)
+        {
+            cap *= 2;
+            if (!(pnew = (char *) realloc(text, cap)))
+            {
+                free(text);
+                errno = ENOMEM;
+                return -1;
+            }
+            text = pnew;
+        }
+        rc = read(fd, text + size, cap - size - 1);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            free(text);
+            return -1;
+        }
+        if (rc == 0)
+            break;
+        size += (size_t) rc;
+    }
+    text[size] = '\0';
+    /* room for the next read() to see the end without a regrowth */
+    cap = size + size / 4 + 1;
+    __atomic_store_n(&linux_text_hint, cap > LINUX_TEXT_MIN ? cap : LINUX_TEXT_MIN,
+                     __ATOMIC_RELAXED);
+    *ptext = text;
+    return (ssize_t) size;
+}
+
+/* parse text into a new table, or -1 with errno */
+static int
+linux_parse_text(char *text, size_t size, linux_scan_fn scan, statfs_t **pbuf)
+{
+    char *end = text + size;
+    char *line = NULL;
+    statfs_t *ptab = NULL;
+    statfs_t *pnew = NULL;
+    int cap = 0;
+    int cnt = 0;
+    int ok = FALSE;
+
+    *pbuf = NULL;
+    /* one entry per line: sized up front, the table is never copied */
+    for (line = text; line < end && (line = memchr(line, '\n', (size_t) (end - line))); ++line)
+        ++cap;
+    ++cap;
+    if (!(ptab = (statfs_t *) malloc(sizeof(statfs_t) * cap)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    while (text < end)
+    {
+        if (cnt == cap)
+        {
+            cap *= 2;
+            if (!(pnew = (statfs_t *) realloc(ptab, sizeof(statfs_t) * cap)))
+            {
+                free(ptab);
+                errno = ENOMEM;
+                return -1;
+            }
+            ptab = pnew;
+        }
+        text = linux_parse_line(text, end, ptab + cnt, scan, &ok);
+        if (ok)
+            ++cnt;
+    }
+    *pbuf = ptab;
+    return cnt;
+}
+
+static int
+linux_read_source(const char *source, statfs_t **pbuf)
+{
+    char *text = NULL;
+    ssize_t size = 0;
+    int err = 0;
+    int cnt = -1;
+    int fd = -1;
+
+    *pbuf = NULL;
+    if ((fd = linux_open_fd(source)) < 0)
+        return -1;
+    if ((size = linux_read_text(fd, &text)) >= 0)
+        cnt = linux_parse_text(text, (size_t) size, linux_scan, pbuf);
+    err = errno;
+    free(text);
+    close(fd);
+    errno = err;
+    return cnt;
+}
+
+static int
+linux_read_mountinfo(statfs_t **pbuf)
+{
+    return linux_read_source(NULL, pbuf);
+}
+
+static void
+linux_refresh(statfs_t *pbuf, int cnt)
+{
+    struct statfs sfs;
+    int i;
+
+    for (i = 0; i < cnt; ++i)
+        if (statfs(pbuf[i].f_mntonname, &sfs) == 0)
+            linux_set_counters(pbuf + i, &sfs);
+}
+
+/*
+ * Refresh pool, for getfsstat(): the statfs() calls spread over native
+ * threads that each own a slice of the table and steal half of another
+ * slice when theirs runs dry.  A call still running `deadline` seconds
+ * after it started marks its thread lost and a replacement takes over;
+ * with MNT_NOWAIT the mount is then reported from its last known
+ * counters with MNT_STALE set instead of being waited for.  A lost
+ * thread is abandoned like a stuck job and rejoins when its call returns.
+ * The threads outlive the calls: up to REFRESH_WORKERS of them park
+ * between calls, so a small table costs a wakeup, not a pthread_create().
+ */
+
+#define REFRESH_WORKERS      8
+#define REFRESH_PER_WORKER   64  /* mounts per thread */
+#define REFRESH_DEADLINE     1.0
+#define MAX_LOST_REFRESHERS  16
+#define REFRESH_SLOTS        (REFRESH_WORKERS + MAX_LOST_REFRESHERS)
+
+#define REFRESH_PENDING  0
+#define REFRESH_RUNNING  1
+#define REFRESH_DONE     2
+#define REFRESH_FAILED   3
+#define REFRESH_SKIPPED  4  /* MNT_NOWAIT: a lost call on it has not returned */
+
+struct refresh_pool;
+
+typedef struct refresh_worker {
+    struct refresh_pool *pool;
+    pthread_mutex_t lock;   /* next, end: the slice */
+    int next;
+    int end;
+    int item;               /* pool lock: running, or -1 */
+    int lost;
+    double started;
+} refresh_worker;
+
+typedef struct refresh_pool {
+    int cnt;
+    char **paths;           /* copies: lost threads outlive the caller */
+    dev_t *devs;
+    struct statfs *sfs;
+    char *state;
+    int done;
+    int late;               /* running on lost threads */
+    int live;               /* started, not lost, not finished */
+    int nworkers;
+    int refs;
+    int abandoned;
+    double deadline;        /* < 0: none */
+    double wake;            /* when the caller checks next, < 0: not armed */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    refresh_worker worker[REFRESH_SLOTS];
+} refresh_pool;
+
+/*
+ * The last counters seen per mount, for MNT_STALE entries: sorted by
+ * mount ID, the device telling a reused ID apart.  Each call updates
+ * only its own mounts, so a filtered call keeps the others; a mount
+ * not seen for REFRESH_KNOWN_AGE seconds is dropped when the table
+ * has to grow.
+ */
+#define REFRESH_KNOWN_AGE  3600.0
+
+typedef struct refresh_known {
+    uint64_t mntid;
+    dev_t dev;
+    double seen;        /* clock_monotonic() */
+    struct statfs sfs;
+} refresh_known;
+
+static pthread_mutex_t refresh_known_lock = PTHREAD_MUTEX_INITIALIZER;
+static refresh_known *refresh_known_tab = NULL;
+static int refresh_known_count = 0;
+static int refresh_known_size = 0;
+static dev_t *refresh_hung = NULL;      /* devices of the lost calls */
+static int refresh_hung_count = 0;
+static int refresh_hung_size = 0;
+static int refresh_lost = 0;
+
+/* a refresh thread, parked between calls */
+typedef struct refresh_thread {
+    struct refresh_thread *next;    /* parked list */
+    refresh_worker *work;           /* NULL while parked */
+    pthread_cond_t cond;
+} refresh_thread;
+
+static pthread_mutex_t refresh_park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t refresh_once = PTHREAD_ONCE_INIT;
+static refresh_thread *refresh_parked = NULL;
+static int refresh_parked_count = 0;
+
+/* the child has none of the threads: forget them and the lost calls */
+static void
+refresh_atfork_child(void)
+{
+    pthread_mutex_init(&refresh_park_lock, NULL);
+    pthread_mutex_init(&refresh_known_lock, NULL);
+    refresh_parked = NULL;
+    refresh_parked_count = 0;
+    refresh_hung_count = 0;
+    refresh_lost = 0;
+}
+
+static void
+refresh_init(void)
+{
+    pthread_atfork(NULL, NULL, refresh_atfork_child);
+}
+
+static void
+refresh_free(refresh_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->nworkers; ++i)
+        pthread_mutex_destroy(&pool->worker[i].lock);
+    for (i = 0; pool->paths && i < pool->cnt; ++i)
+        free(pool->paths[i]);
+    free(pool->paths);
+    free(pool->devs);
+    free(pool->sfs);
+    free(pool->state);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(pool);
+}
+
+static refresh_pool *
+refresh_new(const statfs_t *pbuf, int cnt)
+{
+    refresh_pool *pool = NULL;
+    int i;
+
+    if (!(pool = (refresh_pool *) calloc(1, sizeof(refresh_pool))))
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    cond_init_monotonic(&pool->cond);
+    pool->cnt = cnt;
+    pool->paths = (char **) calloc(cnt + 1, sizeof(char *));
+    pool->devs = (dev_t *) calloc(cnt + 1, sizeof(dev_t));
+    pool->sfs = (struct statfs *) calloc(cnt + 1, sizeof(struct statfs));
+    pool->state = (char *) calloc(cnt + 1, 1);
+    if (!pool->paths || !pool->devs || !pool->sfs || !pool->state)
+        goto error;
+    for (i = 0; i < cnt; ++i)
+    {
+        if (!(pool->paths[i] = strdup(pbuf[i].f_mntonname)))
+            goto error;
+        pool->devs[i] = pbuf[i].l_dev;
+    }
+    return pool;
+
+error:
+    refresh_free(pool);
+    return NULL;
+}
+
+/* refresh_known_lock held */
+static int
+refresh_is_hung(dev_t dev)
+{
+    int i;
+
+    for (i = 0; i < refresh_hung_count; ++i)
+        if (refresh_hung[i] == dev)
+            return TRUE;
+    return FALSE;
+}
+
+static void
+refresh_set_hung(dev_t dev, int hung)
+{
+    dev_t *pnew = NULL;
+    int i;
+
+    pthread_mutex_lock(&refresh_known_lock);
+    if (hung)
+    {
+        if (refresh_hung_count == refresh_hung_size)
+        {
+            refresh_hung_size = refresh_hung_size ? refresh_hung_size * 2 : 16;
+            if ((pnew = (dev_t *) realloc(refresh_hung, sizeof(dev_t) * refresh_hung_size)))
+                refresh_hung = pnew;
+            else
+                refresh_hung_size = refresh_hung_count;
+        }
+        if (refresh_hung_count < refresh_hung_size)
+            refresh_hung[refresh_hung_count++] = dev;
+    }
+    else
+    {
+        for (i = 0; i < refresh_hung_count; ++i)
+            if (refresh_hung[i] == dev)
+            {
+                refresh_hung[i] = refresh_hung[--refresh_hung_count];
+                break;
+            }
+    }
+    pthread_mutex_unlock(&refresh_known_lock);
+}
+
+/* the next item for w: from its slice, else half of another one */
+static int
+refresh_take(refresh_pool *pool, refresh_worker *w)
+{
+    refresh_worker *v = NULL;
+    int nworkers = 0;
+    int half = 0;
+    int item = -1;
+    int j;
+
+    if (__atomic_load_n(&pool->abandoned, __ATOMIC_ACQUIRE))
+        return -1;
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end)
+        item = w->next++;
+    pthread_mutex_unlock(&w->lock);
+    if (item >= 0)
+        return item;
+
+    nworkers = __atomic_load_n(&pool->nworkers, __ATOMIC_ACQUIRE);
+    for (j = 0; j < nworkers && item < 0; ++j)
+    {
+        if ((v = pool->worker + j) == w)
+            continue;
+        pthread_mutex_lock(&v->lock);
+        if ((half = (v->end - v->next + 1) / 2) > 0)
+        {
+            v->end -= half;
+            item = v->end;
+        }
+        pthread_mutex_unlock(&v->lock);
+    }
+    if (item >= 0)
+    {
+        pthread_mutex_lock(&w->lock);
+        w->next = item + 1;
+        w->end = item + half;
+        pthread_mutex_unlock(&w->lock);
+    }
+    return item;
+}
+
+static void
+refresh_work(refresh_worker *w)
+{
+    refresh_pool *pool = w->pool;
+    struct statfs sfs;
+    int last = FALSE;
+    int item = 0;
+    int rc = 0;
+
+    while ((item = refresh_take(pool, w)) >= 0)
+    {
+        if (pool->state[item] == REFRESH_SKIPPED)
+            continue;
+        pthread_mutex_lock(&pool->lock);
+        pool->state[item] = REFRESH_RUNNING;
+        w->item = item;
+        w->started = clock_monotonic();
+        /* the caller sleeps past this deadline: wake it to arm it */
+        if (pool->deadline >= 0 && (pool->wake < 0 || w->started + pool->deadline < pool->wake))
+            pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+
+        rc = statfs(pool->paths[item], &sfs);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!pool->abandoned)
+        {
+            pool->state[item] = (rc == 0) ? REFRESH_DONE : REFRESH_FAILED;
+            if (rc == 0)
+                pool->sfs[item] = sfs;
+        }
+        ++pool->done;
+        w->item = -1;
+        if (w->lost)
+        {
+            w->lost = FALSE;
+            --pool->late;
+            ++pool->live;
+            __atomic_sub_fetch(&refresh_lost, 1, __ATOMIC_RELAXED);
+            refresh_set_hung(pool->devs[item], FALSE);
+        }
+        if (pool->done + pool->late >= pool->cnt)
+            pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    --pool->live;
+    last = (--pool->refs == 0);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    if (last)
+        refresh_free(pool);
+}
+
+/* works a slice, then parks for the next call unless enough threads are parked */
+static void *
+refresh_main(void *arg)
+{
+    refresh_thread *t = (refresh_thread *) arg;
+
+    for (;;)
+    {
+        refresh_work(t->work);
+
+        pthread_mutex_lock(&refresh_park_lock);
+        if (refresh_parked_count >= REFRESH_WORKERS)
+        {
+            pthread_mutex_unlock(&refresh_park_lock);
+            break;
+        }
+        t->work = NULL;
+        t->next = refresh_parked;
+        refresh_parked = t;
+        ++refresh_parked_count;
+        while (!t->work)
+            pthread_cond_wait(&t->cond, &refresh_park_lock);
+        pthread_mutex_unlock(&refresh_park_lock);
+    }
+    pthread_cond_destroy(&t->cond);
+    free(t);
+    return NULL;
+}
+
+/* pool lock held by the caller, or no thread started yet */
+static int
+refresh_start(refresh_pool *pool, int next, int end)
+{
+    refresh_thread *t = NULL;
+    refresh_worker *w = NULL;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int err = 0;
+
+    if (pool->nworkers >= REFRESH_SLOTS)
+        return FALSE;
+    pthread_once(&refresh_once, refresh_init);
+    w = pool->worker + pool->nworkers;
+    w->pool = pool;
+    w->next = next;
+    w->end = end;
+    w->item = -1;
+    pthread_mutex_init(&w->lock, NULL);
+    __atomic_store_n(&pool->nworkers, pool->nworkers + 1, __ATOMIC_RELEASE);
+
+    ++pool->refs;
+    ++pool->live;
+    pthread_mutex_lock(&refresh_park_lock);
+    if ((t = refresh_parked))
+    {
+        refresh_parked = t->next;
+        --refresh_parked_count;
+        t->work = w;
+        pthread_cond_signal(&t->cond);
+    }
+    pthread_mutex_unlock(&refresh_park_lock);
+    if (t)
+        return TRUE;
+
+    if ((t = (refresh_thread *) calloc(1, sizeof(refresh_thread))))
+    {
+        pthread_cond_init(&t->cond, NULL);
+        t->work = w;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        err = pthread_create(&thread, &attr, refresh_main, t);
+        pthread_attr_destroy(&attr);
+        if (err)
+        {
+            pthread_cond_destroy(&t->cond);
+            free(t);
+            t = NULL;
+        }
+    }
+    if (!t)
+    {
+        /* the slot stays, its slice is left to the others */
+        --pool->refs;
+        --pool->live;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* pool lock held: mark the threads past the deadline lost, the next check time */
+static double
+refresh_check(refresh_pool *pool, double deadline, int *pchanged)
+{
+    refresh_worker *w = NULL;
+    double now = clock_monotonic();
+    double wake = -1.0;
+    int j;
+
+    *pchanged = FALSE;
+    for (j = 0; j < pool->nworkers; ++j)
+    {
+        w = pool->worker + j;
+        if (w->item < 0 || w->lost)
+            continue;
+        if (now - w->started < deadline)
+        {
+            if (wake < 0 || w->started + deadline < wake)
+                wake = w->started + deadline;
+            continue;
+        }
+        w->lost = TRUE;
+        --pool->live;
+        ++pool->late;
+        *pchanged = TRUE;
+        refresh_set_hung(pool->devs[w->item], TRUE);
+        if (__atomic_add_fetch(&refresh_lost, 1, __ATOMIC_RELAXED) <= MAX_LOST_REFRESHERS)
+            refresh_start(pool, 0, 0);
+    }
+    return wake;
+}
+
+/* refresh_known_lock held; the entry of pmnt among the first count, or NULL */
+static refresh_known *
+refresh_lookup(const statfs_t *pmnt, int count)
+{
+    int lo = 0;
+    int hi = count;
+    int mid = 0;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (refresh_known_tab[mid].mntid < pmnt->f_mntid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < count && refresh_known_tab[lo].mntid == pmnt->f_mntid)
+        return refresh_known_tab + lo;
+    return NULL;
+}
+
+static int
+refresh_compare_known(const void *a, const void *b)
+{
+    const refresh_known *ka = (const refresh_known *) a;
+    const refresh_known *kb = (const refresh_known *) b;
+
+    return (ka->mntid > kb->mntid) - (ka->mntid < kb->mntid);
+}
+
+/* refresh_known_lock held; room for count entries, FALSE without memory */
+static int
+refresh_known_reserve(int count, double now)
+{
+    refresh_known *pnew = NULL;
+    int size = 0;
+    int i;
+    int j;
+
+    if (count <= refresh_known_size)
+        return TRUE;
+    /* the order is kept, so the table stays sorted */
+    for (i = j = 0; i < refresh_known_count; ++i)
+        if (now - refresh_known_tab[i].seen < REFRESH_KNOWN_AGE)
+            refresh_known_tab[j++] = refresh_known_tab[i];
+    count -= refresh_known_count - j;
+    refresh_known_count = j;
+    if (count <= refresh_known_size)
+        return TRUE;
+    size = refresh_known_size ? refresh_known_size : 64;
+    while (size < count)
+        size *= 2;
+    if (!(pnew = (refresh_known *) realloc(refresh_known_tab, sizeof(refresh_known) * size)))
+        return FALSE;
+    refresh_known_tab = pnew;
+    refresh_known_size = size;
+    return TRUE;
+}
+
+/* results into pbuf; the known counters of these mounts are updated */
+static void
+refresh_collect(refresh_pool *pool, statfs_t *pbuf)
+{
+    refresh_known *known = NULL;
+    uint64_t flags = 0;
+    double now = clock_monotonic();
+    int count = 0;
+    int added = 0;
+    int i;
+
+    pthread_mutex_lock(&refresh_known_lock);
+    count = refresh_known_count;
+    for (i = 0; i < pool->cnt; ++i)
+    {
+        known = refresh_lookup(pbuf + i, count);
+        /* a reused mount ID: another filesystem's counters */
+        if (known && known->dev != pbuf[i].l_dev)
+        {
+            known->dev = pbuf[i].l_dev;
+            memset(&known->sfs, 0, sizeof(known->sfs));
+            if (pool->state[i] != REFRESH_DONE)
+                known = NULL;
+        }
+        if (known)
+            known->seen = now;
+        switch (pool->state[i])
+        {
+        case REFRESH_DONE:
+            linux_set_counters(pbuf + i, pool->sfs + i);
+            if (known)
+                known->sfs = pool->sfs[i];
+            else
+                ++added;
+            break;
+        case REFRESH_FAILED:
+            break;
+        default:
+            flags = pbuf[i].f_flags;
+            if (known)
+                linux_set_counters(pbuf + i, &known->sfs);
+            pbuf[i].f_flags = flags | MNT_STALE;
+            break;
+        }
+    }
+
+    /* new mounts: appended, then sorted in */
+    if (added && !refresh_known_reserve(refresh_known_count + added, now))
+        added = 0;  /* no memory: they are not remembered this time */
+    if (added)
+    {
+        count = refresh_known_count;
+        for (i = 0; i < pool->cnt; ++i)
+        {
+            if (pool->state[i] != REFRESH_DONE || refresh_lookup(pbuf + i, count))
+                continue;
+            known = refresh_known_tab + refresh_known_count++;
+            known->mntid = pbuf[i].f_mntid;
+            known->dev = pbuf[i].l_dev;
+            known->seen = now;
+            known->sfs = pool->sfs[i];
+        }
+        qsort(refresh_known_tab, refresh_known_count, sizeof(refresh_known),
+              refresh_compare_known);
+    }
+    pthread_mutex_unlock(&refresh_known_lock);
+}
+
+/*
+ * Refresh pbuf through the pool; deadline < 0: none.  Without threads
+ * (no memory, none could start) this is linux_refresh().
+ */
+static void
+linux_refresh_pool(statfs_t *pbuf, int cnt, int flags, double deadline)
+{
+    refresh_pool *pool = NULL;
+    double wake = 0;
+    int workers = 0;
+    int changed = FALSE;
+    int last = FALSE;
+    int j;
+
+    if (cnt <= 0)
+        return;
+    /* nothing to watch and one thread's worth of mounts */
+    if (deadline < 0 && cnt <= REFRESH_PER_WORKER)
+    {
+        linux_refresh(pbuf, cnt);
+        return;
+    }
+    if (!(pool = refresh_new(pbuf, cnt)))
+    {
+        linux_refresh(pbuf, cnt);
+        return;
+    }
+    if (flags == MNT_NOWAIT)
+    {
+        /* no second call on a filesystem that already hangs one */
+        pthread_mutex_lock(&refresh_known_lock);
+        for (j = 0; refresh_hung_count && j < cnt; ++j)
+            if (refresh_is_hung(pool->devs[j]))
+            {
+                pool->state[j] = REFRESH_SKIPPED;
+                ++pool->done;
+            }
+        pthread_mutex_unlock(&refresh_known_lock);
+    }
+    workers = (cnt + REFRESH_PER_WORKER - 1) / REFRESH_PER_WORKER;
+    if (workers > REFRESH_WORKERS)
+        workers = REFRESH_WORKERS;
+    pthread_mutex_lock(&pool->lock);
+    pool->refs = 1;
+    pool->deadline = deadline;
+    pool->wake = -1.0;
+    for (j = 0; j < workers; ++j)
+        refresh_start(pool, (int) ((long long) cnt * j / workers),
+                      (int) ((long long) cnt * (j + 1) / workers));
+    if (pool->refs == 1)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        refresh_free(pool);
+        linux_refresh(pbuf, cnt);
+        return;
+    }
+
+    for (;;)
+    {
+        if (pool->done == cnt)
+            break;
+        if (flags == MNT_NOWAIT && (pool->done + pool->late == cnt || pool->live == 0))
+            break;
+        wake = (deadline >= 0) ? refresh_check(pool, deadline, &changed) : -1.0;
+        if (changed)
+            continue;
+        pool->wake = wake;
+        if (wake < 0)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        else
+            cond_wait_until(&pool->cond, &pool->lock, wake);
+    }
+    __atomic_store_n(&pool->abandoned, TRUE, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* abandoned: the threads no longer touch the results */
+    refresh_collect(pool, pbuf);
+
+    pthread_mutex_lock(&pool->lock);
+    last = (--pool->refs == 0);
+    pthread_mutex_unlock(&pool->lock);
+    if (last)
+        refresh_free(pool);
+}
+
+/* filter: pruned by names before the refresh, or NULL */
+static int
+linux_getfsstat(statfs_t **pbuf, int flags, double deadline, const statfs_filter *filter)
+{
+    int cnt;
+
+    if ((cnt = linux_read_mountinfo(pbuf)) < 0)
+        return -1;
+    cnt = filter_apply(filter, *pbuf, cnt, FALSE);
+    linux_refresh_pool(*pbuf, cnt, flags, deadline);
+    return cnt;
+}
+
+static int
+linux_getmntinfo(statfs_t **pbuf, const statfs_filter *filter)
+{
+    int cnt;
+
+    if ((cnt = linux_read_mountinfo(pbuf)) < 0)
+        return -1;
+    cnt = filter_apply(filter, *pbuf, cnt, FALSE);
+    linux_refresh(*pbuf, cnt);
+    return cnt;
+}
+
+/*
+ * Another mount namespace: its table from source (/proc/<pid>/mountinfo)
+ * and its mount points seen through root (/proc/<pid>/root), no setns().
+ */
+static int
+linux_getmntinfo_at(statfs_t **pbuf, const char *source, const char *root,
+                    const statfs_filter *filter)
+{
+    struct statfs sfs;
+    char path[PATH_MAX];
+    size_t rlen = 0;
+    int cnt = 0;
+    int i = 0;
+
+    if ((cnt = linux_read_source(source, pbuf)) < 0)
+        return -1;
+    cnt = filter_apply(filter, *pbuf, cnt, FALSE);
+    if (!root)
+    {
+        linux_refresh(*pbuf, cnt);
+        return cnt;
+    }
+    rlen = strlen(root);
+    while (rlen > 0 && root[rlen - 1] == '/')
+        --rlen;
+    for (i = 0; i < cnt; ++i)
+    {
+        if (snprintf(path, sizeof(path), "%.*s%s", (int) rlen, root,
+                     (*pbuf)[i].f_mntonname) >= (int) sizeof(path))
+            continue;
+        if (statfs(path, &sfs) == 0)
+            linux_set_counters(*pbuf + i, &sfs);
+    }
+    return cnt;
+}
+
+static int
+getmntinfo_r_np(statfs_t **pbuf, int flags)
+{
+    (void) flags;
+
+    return linux_getmntinfo(pbuf, NULL);
+}
+
+static int
+getfsstat(statfs_t *buf, int bufsize, int flags)
+{
+    statfs_t *ptab = NULL;
+    int cnt;
+
+    if ((cnt = linux_read_mountinfo(&ptab)) < 0)
+        return -1;
+    if (buf)
+    {
+        if (cnt > bufsize / (int) sizeof(statfs_t))
+            cnt = bufsize / (int) sizeof(statfs_t);
+        if (cnt > 0)
+            memcpy(buf, ptab, sizeof(statfs_t) * cnt);
+        linux_refresh_pool(buf, cnt, flags, REFRESH_DEADLINE);
+    }
+    free(ptab);
+    return cnt;
+}
+
+/* the names of a table entry; the counters stay */
+static void
+linux_copy_entry(statfs_t *pmnt, const statfs_t *pent)
+{
+    memcpy(pmnt->f_fstypename, pent->f_fstypename, sizeof(pmnt->f_fstypename));
+    memcpy(pmnt->f_mntfromname, pent->f_mntfromname, sizeof(pmnt->f_mntfromname));
+    memcpy(pmnt->f_mntonname, pent->f_mntonname, sizeof(pmnt->f_mntonname));
+    pmnt->f_mntid = pent->f_mntid;
+    pmnt->l_dev = pent->l_dev;
+}
+
+static size_t
+linux_path_prefix(const char *path, const char *mnt)
+{
+    size_t len = strlen(mnt);
+
+    if (len == 1 && mnt[0] == '/')
+        return 1;
+    if (strncmp(path, mnt, len) != 0)
+        return 0;
+    if (path[len] != '\0' && path[len] != '/')
+        return 0;
+    return len;
+}
+
+/*
+ * Pick the mount of (dev, path): a device match wins, then the longest
+ * mount point prefix, then the last entry (the top of an overmount).
+ * Without a table the mount table is read here.
+ */
+static void
+linux_lookup_mount(statfs_t *pmnt, dev_t dev, const char *path,
+                   const statfs_t *ptab, int cnt)
+{
+    statfs_t *pown = NULL;
+    size_t blen = 0;
+    size_t len = 0;
+    int bdev = FALSE;
+    int mdev = FALSE;
+    int best = -1;
+    int i;
+
+    if (!ptab)
+    {
+        if ((cnt = linux_read_mountinfo(&pown)) < 0)
+            return;
+        ptab = pown;
+    }
+    for (i = 0; i < cnt; ++i)
+    {
+        len = path ? linux_path_prefix(path, ptab[i].f_mntonname) : 0;
+        mdev = (ptab[i].l_dev == dev);
+        if (!mdev && !len)
+            continue;
+        if (best >= 0 && (bdev > mdev || (bdev == mdev && blen > len)))
+            continue;
+        best = i;
+        bdev = mdev;
+        blen = len;
+    }
+    if (best >= 0)
+        linux_copy_entry(pmnt, &ptab[best]);
+    free(pown);
+}
+
+/*
+ * Mount ID of a path (AT_EMPTY_PATH: of dirfd itself), the first field
+ * of mountinfo.  Unlike st_dev it tells bind mounts and overmounts of
+ * one device apart.  Kernels before 5.8 fill no STATX_MNT_ID and those
+ * before 4.11 have no statx(): then the lookup is given up for good.
+ */
+static int linux_statx_failed = FALSE;
+
+static int
+linux_mount_id(int dirfd, const char *path, int flags, uint64_t *pid)
+{
+#ifdef STATX_MNT_ID
+    struct statx stx;
+
+    if (__atomic_load_n(&linux_statx_failed, __ATOMIC_RELAXED))
+        return FALSE;
+    if (statx(dirfd, path, flags | AT_STATX_DONT_SYNC, STATX_MNT_ID, &stx) < 0)
+    {
+        if (errno == ENOSYS)
+            __atomic_store_n(&linux_statx_failed, TRUE, __ATOMIC_RELAXED);
+        return FALSE;
+    }
+    if (!(stx.stx_mask & STATX_MNT_ID))
+    {
+        __atomic_store_n(&linux_statx_failed, TRUE, __ATOMIC_RELAXED);
+        return FALSE;
+    }
+    *pid = (uint64_t) stx.stx_mnt_id;
+    return TRUE;
+#else  /* !STATX_MNT_ID */
+    (void) dirfd;
+    (void) path;
+    (void) flags;
+    (void) pid;
+    return FALSE;
+#endif /* !STATX_MNT_ID */
+}
+
+/* the IDs of a mount_source() file belong to another system */
+static int
+linux_fake_source(void)
+{
+    int fake = FALSE;
+
+    pthread_mutex_lock(&linux_source_lock);
+    fake = (linux_source != NULL);
+    pthread_mutex_unlock(&linux_source_lock);
+    return fake;
+}
+
+static int cache_lookup_id(statfs_t *pmnt);
+
+/*
+ * The names of the mount of pmnt->f_mntid: a scan of the table of a
+ * batch, otherwise a hash lookup in the getmntinfo(cached=True) cache.
+ */
+static int
+linux_lookup_id(statfs_t *pmnt, const statfs_t *ptab, int cnt)
+{
+    int i;
+
+    if (linux_fake_source())
+        return FALSE;
+    if (!ptab)
+        return cache_lookup_id(pmnt);
+    for (i = 0; i < cnt; ++i)
+    {
+        if (ptab[i].f_mntid == pmnt->f_mntid)
+        {
+            linux_copy_entry(pmnt, &ptab[i]);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static int
+linux_statfs_r(const char *path, statfs_t *pmnt, const statfs_t *ptab, int cnt)
+{
+    char real[PATH_MAX];
+    struct statfs sfs;
+    struct stat st;
+
+    if (statfs(path, &sfs) < 0)
+        return -1;
+    memset(pmnt, 0, sizeof(*pmnt));
+    linux_set_counters(pmnt, &sfs);
+    if (linux_mount_id(AT_FDCWD, path, 0, &pmnt->f_mntid) &&
+        linux_lookup_id(pmnt, ptab, cnt))
+        return 0;
+    if (stat(path, &st) == 0)
+        linux_lookup_mount(pmnt, st.st_dev, realpath(path, real), ptab, cnt);
+    return 0;
+}
+
+static int
+linux_fstatfs_r(int fd, statfs_t *pmnt, const statfs_t *ptab, int cnt)
+{
+    char link[64];
+    char real[PATH_MAX];
+    struct statfs sfs;
+    struct stat st;
+    ssize_t len;
+
+    if (fstatfs(fd, &sfs) < 0)
+        return -1;
+    memset(pmnt, 0, sizeof(*pmnt));
+    linux_set_counters(pmnt, &sfs);
+    if (linux_mount_id(fd, "", AT_EMPTY_PATH, &pmnt->f_mntid) &&
+        linux_lookup_id(pmnt, ptab, cnt))
+        return 0;
+    if (fstat(fd, &st) == 0)
+    {
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        len = readlink(link, real, sizeof(real) - 1);
+        if (len > 0 && real[0] == '/')
+            real[len] = '\0';
+        else
+            len = 0;
+        linux_lookup_mount(pmnt, st.st_dev, len ? real : NULL, ptab, cnt);
+    }
+    return 0;
+}
+
+#define statfs_path_r(p, b, t, n)  linux_statfs_r((p), (b), (t), (n))
+#define statfs_fd_r(f, b, t, n)    linux_fstatfs_r((f), (b), (t), (n))
+
+#else  /* !LINUX */
+
+#define statfs_path_r(p, b, t, n)  statfs((p), (b))
+#define statfs_fd_r(f, b, t, n)    fstatfs((f), (b))
+
+#endif /* !LINUX */
+
+/* statfs(dir_fd=): openat() for nothing but the fstatfs() */
+#ifdef O_PATH
+#  define STATFS_AT_FLAGS  (O_PATH | O_CLOEXEC)
+#else  /* !O_PATH */
+#  define STATFS_AT_FLAGS  (O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC)
+#endif /* !O_PATH */
+
+static int
+statfs_at_r(int dirfd, const char *path, statfs_t *pmnt)
+{
+    int fd = -1;
+    int res = 0;
+    int err = 0;
+
+    if ((fd = openat(dirfd, path, STATFS_AT_FLAGS)) < 0)
+        return -1;
+    res = statfs_fd_r(fd, pmnt, NULL, 0);
+    err = errno;
+    close(fd);
+    errno = err;
+    return res;
+}
+
+/*
+ *
+ */
+
+enum statfs_index {
+    STATFS_VERSION,
+    STATFS_OTYPE,
+    STATFS_OFLAGS,
+    STATFS_FLAGS,
+    STATFS_FLAGS_EXT,
+    STATFS_OWNER,
+
+    STATFS_FSID,
+    STATFS_TYPE,
+    STATFS_FSSUBTYPE,
+    STATFS_NAMEMAX,
+
+    STATFS_FSTYPENAME,
+    STATFS_MNTFROMNAME,
+    STATFS_MNTONNAME,
+    STATFS_SPARE,
+    STATFS_CHARSPARE,
+
+    STATFS_IOSIZE,
+    STATFS_BSIZE,
+    STATFS_BLOCKS,
+    STATFS_BAVAIL,
+    STATFS_BFREE,
+
+    STATFS_FFREE,
+    STATFS_FILES,
+
+    STATFS_SYNCWRITES,
+    STATFS_ASYNCWRITES,
+    STATFS_SYNCREADS,
+    STATFS_ASYNCREADS,
+
+    STATFS_RESERVED,
+    STATFS_RESERVED1,
+    STATFS_RESERVED2,
+    STATFS_RESERVED3,
+    STATFS_RESERVED4,
+
+    STATFS_FRSIZE,
+    STATFS_FAVAIL,
+    STATFS_MNTID,
+
+    STATFS_MEMBERS
+};
+
+static const char *statfs_member[STATFS_MEMBERS][2] = {
+    { "f_version",     "F" }, /* FBSD */
+    { "f_otype",       "d" }, /* DF32 */
+    { "f_oflags",      "d" }, /* DF32 */
+    { "f_flags",       "-" },
+    { "f_flags_ext",   "D" }, /* DF64 */
+    { "f_owner",       "FDd" },
+
+    { "f_fsid",        "-" },
+    { "f_type",        "-" },
+    { "f_fssubtype",   "D" }, /* DF64 */
+    { "f_namemax",     "FL" }, /* FBSD, LINUX */
+
+    { "f_fstypename",  "-" },
+    { "f_mntfromname", "-" },
+    { "f_mntonname",   "-" },
+    { "f_spare",       "F" }, /* FBSD */
+    { "f_charspare",   "F" }, /* FBSD */
+
+    { "f_iosize",      "-" },
+    { "f_bsize",       "-" },
+    { "f_blocks",      "-" },
+    { "f_bavail",      "-" },
+    { "f_bfree",       "-" },
+
+    { "f_ffree",       "-" },
+    { "f_files",       "-" },
+
+    { "f_syncwrites",  "F" }, /* FBSD */
+    { "f_asyncwrites", "F" }, /* FBSD */
+    { "f_syncreads",   "F" }, /* FBSD */
+    { "f_asyncreads",  "F" }, /* FBSD */
+
+    { "f_reserved",    "D" }, /* DF64 */
+    { "f_reserved1",   "d" }, /* DF32 */
+    { "f_reserved2",   "d" }, /* DF32 */
+    { "f_reserved3",   "d" }, /* DF32 */
+    { "f_reserved4",   "d" }, /* DF32 */
+
+    { "f_frsize",      "L" }, /* LINUX */
+    { "f_favail",      "L" }, /* LINUX */
+    { "f_mntid",       "L" }, /* LINUX */
+};
+
+/*
+ * Module state: the types and the object caches of one module object,
+ * so that every interpreter importing statfs gets its own.
+ *
+ * Intern tables for mount names and the stable numeric members, which
+ * repeat on every poll.  Both are direct-mapped: a miss replaces the
+ * slot, so the tables never hold more than INTERN_STRINGS strings and
+ * INTERN_NUMBERS integers.  Counters (f_bavail, f_bfree, f_ffree) are
+ * not interned, they would only evict the hot values.  A thread finding
+ * intern_lock taken (free-threaded builds) skips the tables rather than
+ * waiting for them.
+ */
+
+#define INTERN_STRINGS  1024 /* power of 2 */
+#define INTERN_NUMBERS  256  /* power of 2 */
+
+typedef struct statfs_state {
+    PyTypeObject *statfs_type;
+    PyTypeObject *lazy_statfs_type;
+    PyTypeObject *statfs_buffer_type;
+    PyTypeObject *mount_watcher_type;
+    PyTypeObject *mount_changes_type;
+    PyTypeObject *snapshot_type;
+    PyTypeObject *snapshot_changes_type;
+    PyTypeObject *poller_type;
+    PyTypeObject *mount_index_type;
+    PyTypeObject *capacity_type;
+    PyTypeObject *sampler_type;
+    PyTypeObject *mount_iterator_type;
+
+    pthread_mutex_t intern_lock;
+    struct {
+        uint64_t hash;
+        PyObject *value;
+    } intern_strings[INTERN_STRINGS];
+    struct {
+        unsigned long long key;
+        PyObject *value;
+    } intern_numbers[INTERN_NUMBERS];
+    unsigned long long intern_hits;
+    unsigned long long intern_misses;
+
+    /* getmntinfo(cached=True): the last list, valid while cache_serial holds */
+    pthread_mutex_t list_lock;
+    PyObject *cache_list;
+    unsigned long cache_list_serial;
+
+    int locked;         /* the locks above are initialized */
+} statfs_state;
+
+static PyModuleDef statfs_def;
+
+static inline statfs_state *
+module_state(PyObject *module)
+{
+    return (statfs_state *) PyModule_GetState(module);
+}
+
+/* the state of the module that defined type */
+static statfs_state *
+type_state(PyTypeObject *type)
+{
+    PyObject *module = NULL;
+
+#if PyVER_OLDER(3, 11)
+    module = PyType_GetModule(type);
+#else  /* >= 3.11 */
+    module = PyType_GetModuleByDef(type, &statfs_def);
+#endif
+    return module ? module_state(module) : NULL;
+}
+
+static PyObject *
+intern_string(statfs_state *st, const char *str)
+{
+    const unsigned char *p = (const unsigned char *) str;
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+    const char *cached = NULL;
+    PyObject *value = NULL;
+    Py_ssize_t clen = 0;
+    size_t len = 0;
+    size_t slot = 0;
+
+    for (; *p; ++p)
+        hash = (hash ^ *p) * 1099511628211ULL;
+    len = (size_t) (p - (const unsigned char *) str);
+    slot = (size_t) (hash & (INTERN_STRINGS - 1));
+
+    if (pthread_mutex_trylock(&st->intern_lock) != 0)
+        return PyUnicode_FromStringAndSize(str, (Py_ssize_t) len);
+    if ((value = st->intern_strings[slot].value) && st->intern_strings[slot].hash == hash &&
+        (cached = PyUnicode_AsUTF8AndSize(value, &clen)) &&
+        (size_t) clen == len && memcmp(cached, str, len) == 0)
+    {
+        ++st->intern_hits;
+        Py_IncRef(value);
+        pthread_mutex_unlock(&st->intern_lock);
+        return value;
+    }
+
+    if ((value = PyUnicode_FromStringAndSize(str, (Py_ssize_t) len)))
+    {
+        ++st->intern_misses;
+        Py_XDECREF(st->intern_strings[slot].value);
+        Py_IncRef(value);
+        st->intern_strings[slot].value = value;
+        st->intern_strings[slot].hash = hash;
+    }
+    pthread_mutex_unlock(&st->intern_lock);
+    return value;
+}
+
+static PyObject *
+intern_number(statfs_state *st, unsigned long long num)
+{
+    PyObject *value = NULL;
+    size_t slot = 0;
+
+    if (num <= 256)
+        return PyLong_FromUnsignedLongLong(num); /* small ints are cached */
+
+    slot = (size_t) ((num * 0x9E3779B97F4A7C15ULL) >> 56) & (INTERN_NUMBERS - 1);
+    if (pthread_mutex_trylock(&st->intern_lock) != 0)
+        return PyLong_FromUnsignedLongLong(num);
+    if ((value = st->intern_numbers[slot].value) && st->intern_numbers[slot].key == num)
+    {
+        ++st->intern_hits;
+        Py_IncRef(value);
+        pthread_mutex_unlock(&st->intern_lock);
+        return value;
+    }
+
+    if ((value = PyLong_FromUnsignedLongLong(num)))
+    {
+        ++st->intern_misses;
+        Py_XDECREF(st->intern_numbers[slot].value);
+        Py_IncRef(value);
+        st->intern_numbers[slot].value = value;
+        st->intern_numbers[slot].key = num;
+    }
+    pthread_mutex_unlock(&st->intern_lock);
+    return value;
+}
+
+static void
+intern_clear(statfs_state *st)
+{
+    int i;
+
+    pthread_mutex_lock(&st->intern_lock);
+    for (i = 0; i < INTERN_STRINGS; ++i)
+        Py_CLEAR(st->intern_strings[i].value);
+    for (i = 0; i < INTERN_NUMBERS; ++i)
+        Py_CLEAR(st->intern_numbers[i].value);
+    st->intern_hits = 0;
+    st->intern_misses = 0;
+    pthread_mutex_unlock(&st->intern_lock);
+}
+
+/*
+ *
+ */
+
+static PyObject *
+build_statfs_member(statfs_state *st, const statfs_t *pmnt, int index)
+{
+    PyObject *value = NULL;
+    PyObject *item = NULL;
+    Py_ssize_t cnt = 0;
+    Py_ssize_t i = 0;
+
+    (void) value;
+    (void) item;
+    (void) cnt;
+    (void) i;
+
+#define build_statfs_gen_str(n) return intern_string(st, (const char *)pmnt->f_##n)
+#define build_statfs_gen_hot(n) return intern_number(st, (unsigned long long) pmnt->f_##n)
+#define build_statfs_gen_l(n)   return PyLong_FromLong((long) pmnt->f_##n)
+#define build_statfs_gen_ul(n)  return PyLong_FromUnsignedLong((unsigned long) pmnt->f_##n)
+#define build_statfs_gen_ull(n) return PyLong_FromUnsignedLongLong((unsigned long long) pmnt->f_##n)
+#define build_statfs_gen_tuple(array, conv)                             \
+    cnt = (Py_ssize_t) (sizeof(array) / sizeof((array)[0]));            \
+    if (!(value = PyTuple_New(cnt)))                                    \
+        return NULL;                                                    \
+    for (i = 0; i < cnt; ++i)                                           \
+    {                                                                   \
+        if (!(item = conv((array)[i])))                                 \
+        {                                                               \
+            Py_DecRef(value);                                           \
+            return NULL;                                                \
+        }                                                               \
+        TupleMoveItem(value, i, &item);                                 \
+    }                                                                   \
+    return value
+
+    switch (index)
+    {
+    case STATFS_FLAGS:       build_statfs_gen_hot(flags);
+#ifndef COMPILE_LINUX
+    case STATFS_OWNER:       build_statfs_gen_l(owner);
+#endif /* !COMPILE_LINUX */
+
+    case STATFS_FSID:        build_statfs_gen_tuple(pmnt->f_fsid.val, PyLong_FromLong);
+    case STATFS_TYPE:        build_statfs_gen_hot(type);
+
+    case STATFS_FSTYPENAME:  build_statfs_gen_str(fstypename);
+    case STATFS_MNTFROMNAME: build_statfs_gen_str(mntfromname);
+    case STATFS_MNTONNAME:   build_statfs_gen_str(mntonname);
+
+    case STATFS_IOSIZE:      build_statfs_gen_hot(iosize);
+    case STATFS_BSIZE:       build_statfs_gen_hot(bsize);
+    case STATFS_BLOCKS:      build_statfs_gen_hot(blocks);
+    case STATFS_BAVAIL:      build_statfs_gen_ull(bavail);
+    case STATFS_BFREE:       build_statfs_gen_ull(bfree);
+
+    case STATFS_FFREE:       build_statfs_gen_ull(ffree);
+    case STATFS_FILES:       build_statfs_gen_hot(files);
+
+#ifdef COMPILE_FREEBSD
+    case STATFS_VERSION:     build_statfs_gen_ul(version);
+    case STATFS_NAMEMAX:     build_statfs_gen_ul(namemax);
+    case STATFS_SPARE:       build_statfs_gen_str(spare);
+    case STATFS_CHARSPARE:   build_statfs_gen_str(charspare);
+    case STATFS_SYNCWRITES:  build_statfs_gen_ull(syncwrites);
+    case STATFS_ASYNCWRITES: build_statfs_gen_ull(asyncwrites);
+    case STATFS_SYNCREADS:   build_statfs_gen_ull(syncreads);
+    case STATFS_ASYNCREADS:  build_statfs_gen_ull(asyncreads);
+#endif /* COMPILE_FREEBSD */
+#ifdef COMPILE_LINUX
+    case STATFS_NAMEMAX:     build_statfs_gen_hot(namemax);
+    case STATFS_FRSIZE:      build_statfs_gen_hot(frsize);
+    case STATFS_FAVAIL:      build_statfs_gen_ull(favail);
+    case STATFS_MNTID:       build_statfs_gen_hot(mntid);
+#endif /* COMPILE_LINUX */
+#ifdef USE_STATFS_DF32
+    case STATFS_OTYPE:       build_statfs_gen_l(otype);
+    case STATFS_OFLAGS:      build_statfs_gen_l(oflags);
+    case STATFS_RESERVED1:   build_statfs_gen_l(reserved1);
+    case STATFS_RESERVED2:   build_statfs_gen_tuple(pmnt->f_reserved2, PyLong_FromLong);
+    case STATFS_RESERVED3:   build_statfs_gen_l(reserved3);
+    case STATFS_RESERVED4:   build_statfs_gen_tuple(pmnt->f_reserved4, PyLong_FromLong);
+#endif /* USE_STATFS_DF32 */
+#ifdef USE_STATFS_DF64
+    case STATFS_FLAGS_EXT:   build_statfs_gen_ul(flags_ext);
+    case STATFS_FSSUBTYPE:   build_statfs_gen_ul(fssubtype);
+    case STATFS_RESERVED:    build_statfs_gen_tuple(pmnt->f_reserved, PyLong_FromUnsignedLong);
+#endif /* USE_STATFS_DF64 */
+
+    default:
+        return NewNone();
+    }
+
+#undef build_statfs_gen_str
+#undef build_statfs_gen_hot
+#undef build_statfs_gen_l
+#undef build_statfs_gen_ul
+#undef build_statfs_gen_ull
+#undef build_statfs_gen_tuple
+}
+
+static PyObject *
+build_statfs(statfs_state *st, const statfs_t *pmnt)
+{
+    PyObject *pinfo = NULL;
+    PyObject *item = NULL;
+    int i;
+
+    if (!(pinfo = PyStructSequence_New(st->statfs_type)))
+        return NULL;
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+    {
+        if (!(item = build_statfs_member(st, pmnt, i)))
+        {
+            Py_DecRef(pinfo);
+            return NULL;
+        }
+        PyStructSequence_SET_ITEM(pinfo, i, item);
+    }
+    return pinfo;
+}
+
+static PyObject *
+statfs_asdict(PyObject *self, PyObject *args)
+{
+    PyObject *dict = NULL;
+    int i;
+
+    (void) args;
+
+    if (!(dict = PyDict_New()))
+        return NULL;
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+        if (PyDict_SetItemString(dict, statfs_member[i][0],
+                                 PyStructSequence_GET_ITEM(self, i)) < 0)
+        {
+            Py_DecRef(dict);
+            return NULL;
+        }
+    return dict;
+}
+
+/*
+ * lazy_statfs: keeps a copy of statfs_t and converts each member on
+ * first access.  A Poller record is live: Poller rewrites it in place,
+ * so it hashes and compares by identity instead of by content.
+ */
+
+typedef struct lazy_statfs_object {
+    PyObject_HEAD
+    PyObject *cache[STATFS_MEMBERS];
+    int live;
+    statfs_t mnt;
+} lazy_statfs_object;
+
+
+static PyObject *
+build_lazy_statfs(statfs_state *st, const statfs_t *pmnt)
+{
+    lazy_statfs_object *self = NULL;
+
+    if (!(self = PyObject_New(lazy_statfs_object, st->lazy_statfs_type)))
+        return NULL;
+    memset(self->cache, 0, sizeof(self->cache));
+    self->live = FALSE;
+    memcpy(&self->mnt, pmnt, sizeof(statfs_t));
+    return (PyObject *) self;
+}
+
+/*
+ * fields=(...): only the named members are converted, into a plain tuple
+ * in the requested order.
+ */
+
+typedef struct statfs_projection {
+    int count;
+    int index[STATFS_MEMBERS];
+} statfs_projection;
+
+/* NULL or None: every member (count 0) */
+static int
+parse_fields(PyObject *obj, statfs_projection *proj)
+{
+    PyObject *seq = NULL;
+    PyObject *name = NULL;
+    Py_ssize_t count = 0;
+    Py_ssize_t i = 0;
+    int index = 0;
+
+    proj->count = 0;
+    if (!obj || obj == Py_None)
+        return TRUE;
+    if (PyUnicode_Check(obj) || PyBytes_Check(obj))
+    {
+        PyErr_SetString(PyExc_TypeError, "fields must be a sequence of member names");
+        return FALSE;
+    }
+    if (!(seq = PySequence_Fast(obj, "fields must be a sequence of member names")))
+        return FALSE;
+    count = PySequence_Fast_GET_SIZE(seq);
+    if (count == 0 || count > STATFS_MEMBERS)
+    {
+        PyErr_Format(PyExc_ValueError, "fields must name 1 to %d members", STATFS_MEMBERS);
+        goto error;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        name = PySequence_Fast_GET_ITEM(seq, i);
+        if (!PyUnicode_Check(name))
+        {
+            PyErr_SetString(PyExc_TypeError, "fields must be a sequence of member names");
+            goto error;
+        }
+        for (index = 0; index < STATFS_MEMBERS; ++index)
+            if (PyUnicode_CompareWithASCIIString(name, statfs_member[index][0]) == 0)
+                break;
+        if (index == STATFS_MEMBERS)
+        {
+            PyErr_Format(PyExc_ValueError, "unknown member: %R", name);
+            goto error;
+        }
+        proj->index[i] = index;
+    }
+    proj->count = (int) count;
+    Py_DecRef(seq);
+    return TRUE;
+
+error:
+    Py_DecRef(seq);
+    return FALSE;
+}
+
+static PyObject *
+build_projection(statfs_state *st, const statfs_t *pmnt, const statfs_projection *proj)
+{
+    PyObject *pinfo = NULL;
+    PyObject *item = NULL;
+    int i;
+
+    if (!(pinfo = PyTuple_New(proj->count)))
+        return NULL;
+    for (i = 0; i < proj->count; ++i)
+    {
+        if (!(item = build_statfs_member(st, pmnt, proj->index[i])))
+        {
+            Py_DecRef(pinfo);
+            return NULL;
+        }
+        TupleMoveItem(pinfo, i, &item);
+    }
+    return pinfo;
+}
+
+/*
+ * Filter arguments
+ */
+
+static int
+parse_types(PyObject *obj, PyObject **pseq, const char ***pnames, Py_ssize_t *pcount)
+{
+    const char **names = NULL;
+    PyObject *item = NULL;
+    Py_ssize_t count = 0;
+    Py_ssize_t i = 0;
+
+    if (!obj || obj == Py_None)
+        return TRUE;
+    if (PyUnicode_Check(obj) || PyBytes_Check(obj))
+    {
+        PyErr_SetString(PyExc_TypeError, "filesystem types must be a sequence of str");
+        return FALSE;
+    }
+    if (!(*pseq = PySequence_Fast(obj, "filesystem types must be a sequence of str")))
+        return FALSE;
+    count = PySequence_Fast_GET_SIZE(*pseq);
+    if (!(names = (const char **) PyMem_Malloc(sizeof(char *) * (count + 1))))
+    {
+        PyErr_NoMemory();
+        return FALSE;
+    }
+    *pnames = names;
+    for (i = 0; i < count; ++i)
+    {
+        item = PySequence_Fast_GET_ITEM(*pseq, i);
+        if (!PyUnicode_Check(item))
+        {
+            PyErr_SetString(PyExc_TypeError, "filesystem types must be a sequence of str");
+            return FALSE;
+        }
+        if (!(names[i] = PyUnicode_AsUTF8AndSize(item, NULL)))
+            return FALSE;
+    }
+    *pcount = count;
+    return TRUE;
+}
+
+static void
+filter_exit(statfs_filter *filter)
+{
+    PyMem_Free((void *) filter->include_names);
+    PyMem_Free((void *) filter->exclude_names);
+    Py_XDECREF(filter->include);
+    Py_XDECREF(filter->exclude);
+    memset(filter, 0, sizeof(*filter));
+}
+
+/* on failure the filter is released */
+static int
+parse_filter(statfs_filter *filter, PyObject *include, PyObject *exclude,
+             unsigned long long require_flags, unsigned long long exclude_flags,
+             PyObject *prefix)
+{
+    memset(filter, 0, sizeof(*filter));
+    if (!parse_types(include, &filter->include, &filter->include_names, &filter->include_count) ||
+        !parse_types(exclude, &filter->exclude, &filter->exclude_names, &filter->exclude_count))
+        goto error;
+    filter->require_flags = require_flags;
+    filter->exclude_flags = exclude_flags;
+    if (prefix && prefix != Py_None)
+    {
+        if (!PyUnicode_Check(prefix))
+        {
+            PyErr_SetString(PyExc_TypeError, "path_prefix must be str");
+            goto error;
+        }
+        if (!(filter->prefix = PyUnicode_AsUTF8AndSize(prefix, NULL)))
+            goto error;
+        /* "/mnt/" matches like "/mnt"; "/" matches everything */
+        filter->prefix_len = strlen(filter->prefix);
+        while (filter->prefix_len > 1 && filter->prefix[filter->prefix_len - 1] == '/')
+            --filter->prefix_len;
+    }
+    filter->active = filter->include || filter->exclude ||
+                     require_flags || exclude_flags || filter->prefix;
+    return TRUE;
+
+error:
+    filter_exit(filter);
+    return FALSE;
+}
+
+/* proj: NULL or empty for whole records */
+static PyObject *
+build_record(statfs_state *st, const statfs_t *pmnt, int lazy, const statfs_projection *proj)
+{
+    if (proj && proj->count)
+        return build_projection(st, pmnt, proj);
+    return lazy ? build_lazy_statfs(st, pmnt) : build_statfs(st, pmnt);
+}
+
+static void
+lazy_statfs_dealloc(lazy_statfs_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+    int i;
+
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+        Py_XDECREF(self->cache[i]);
+    PyObject_Free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+/* borrowed, inside a critical section on self */
+static PyObject *
+lazy_statfs_cached(lazy_statfs_object *self, statfs_state *st, int index)
+{
+    if (!self->cache[index])
+        self->cache[index] = build_statfs_member(st, &self->mnt, index);
+    return self->cache[index];
+}
+
+/* a new reference: Poller may replace the cache from another thread */
+static PyObject *
+lazy_statfs_member(lazy_statfs_object *self, int index)
+{
+    statfs_state *st = NULL;
+    PyObject *item = NULL;
+
+    if (!(st = type_state(Py_TYPE(self))))
+        return NULL;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    item = lazy_statfs_cached(self, st, index);
+    Py_XINCREF(item);
+    Py_END_CRITICAL_SECTION();
+    return item;
+}
+
+static PyObject *
+lazy_statfs_tuple(lazy_statfs_object *self)
+{
+    statfs_state *st = NULL;
+    PyObject *tuple = NULL;
+    PyObject *item = NULL;
+    int i;
+
+    if (!(st = type_state(Py_TYPE(self))))
+        return NULL;
+    if (!(tuple = PyTuple_New(STATFS_MEMBERS)))
+        return NULL;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+    {
+        if (!(item = lazy_statfs_cached(self, st, i)))
+        {
+            Py_CLEAR(tuple);
+            break;
+        }
+        Py_IncRef(item);
+        PyTuple_SET_ITEM(tuple, i, item);
+    }
+    Py_END_CRITICAL_SECTION();
+    return tuple;
+}
+
+static PyObject *
+lazy_statfs_get(lazy_statfs_object *self, void *closure)
+{
+    return lazy_statfs_member(self, (int) (intptr_t) closure);
+}
+
+static Py_ssize_t
+lazy_statfs_length(lazy_statfs_object *self)
+{
+    (void) self;
+    return STATFS_MEMBERS;
+}
+
+static PyObject *
+lazy_statfs_item(lazy_statfs_object *self, Py_ssize_t index)
+{
+    if (index < 0 || index >= STATFS_MEMBERS)
+    {
+        PyErr_SetString(PyExc_IndexError, "statfs index out of range");
+        return NULL;
+    }
+    return lazy_statfs_get(self, (void *) (intptr_t) index);
+}
+
+static PyObject *
+lazy_statfs_subscript(lazy_statfs_object *self, PyObject *key)
+{
+    PyObject *tuple = NULL;
+    PyObject *value = NULL;
+    Py_ssize_t index = 0;
+
+    if (PySlice_Check(key))
+    {
+        if (!(tuple = lazy_statfs_tuple(self)))
+            return NULL;
+        value = PyObject_GetItem(tuple, key);
+        Py_DecRef(tuple);
+        return value;
+    }
+    if ((index = PyNumber_AsSsize_t(key, PyExc_IndexError)) == -1 && PyErr_Occurred())
+        return NULL;
+    if (index < 0)
+        index += STATFS_MEMBERS;
+    return lazy_statfs_item(self, index);
+}
+
+static PyObject *
+lazy_statfs_richcompare(lazy_statfs_object *self, PyObject *other, int op)
+{
+    PyObject *tuple = NULL;
+    PyObject *otuple = NULL;
+    PyObject *res = NULL;
+
+    if (self->live)
+        Py_RETURN_NOTIMPLEMENTED;
+    if (Py_TYPE(other) == Py_TYPE(self))
+    {
+        if (((lazy_statfs_object *) other)->live)
+            Py_RETURN_NOTIMPLEMENTED;
+        otuple = lazy_statfs_tuple((lazy_statfs_object *) other);
+    }
+    else if (PyTuple_Check(other))
+    {
+        Py_IncRef(other);
+        otuple = other;
+    }
+    else
+        Py_RETURN_NOTIMPLEMENTED;
+    if (otuple && (tuple = lazy_statfs_tuple(self)))
+        res = PyObject_RichCompare(tuple, otuple, op);
+    Py_XDECREF(tuple);
+    Py_XDECREF(otuple);
+    return res;
+}
+
+static Py_hash_t
+lazy_statfs_hash(lazy_statfs_object *self)
+{
+    PyObject *tuple = NULL;
+    Py_hash_t hash = -1;
+
+    if (self->live)
+        return PyBaseObject_Type.tp_hash((PyObject *) self);
+    if ((tuple = lazy_statfs_tuple(self)))
+    {
+        hash = PyObject_Hash(tuple);
+        Py_DecRef(tuple);
+    }
+    return hash;
+}
+
+static PyObject *
+lazy_statfs_repr(lazy_statfs_object *self)
+{
+    PyObject *tuple = NULL;
+    PyObject *parts = NULL;
+    PyObject *item = NULL;
+    PyObject *sep = NULL;
+    PyObject *body = NULL;
+    PyObject *repr = NULL;
+    int i;
+
+    if (!(tuple = lazy_statfs_tuple(self)))
+        return NULL;
+    if (!(parts = PyList_New(STATFS_MEMBERS)))
+        goto exit;
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+    {
+        if (!(item = PyUnicode_FromFormat("%s=%R", statfs_member[i][0],
+                                          PyTuple_GET_ITEM(tuple, i))))
+            goto exit;
+        ListMoveItem(parts, i, &item);
+    }
+    if (!(sep = PyUnicode_FromString(", ")))
+        goto exit;
+    if (!(body = PyUnicode_Join(sep, parts)))
+        goto exit;
+    repr = PyUnicode_FromFormat("%s(%U)", Py_TYPE(self)->tp_name, body);
+exit:
+    Py_XDECREF(body);
+    Py_XDECREF(sep);
+    Py_XDECREF(parts);
+    Py_DecRef(tuple);
+    return repr;
+}
+
+static PyObject *
+lazy_statfs_asdict(lazy_statfs_object *self, PyObject *args)
+{
+    PyObject *dict = NULL;
+    PyObject *item = NULL;
+    int i;
+
+    (void) args;
+
+    if (!(dict = PyDict_New()))
+        return NULL;
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+    {
+        if (!(item = lazy_statfs_member(self, i)) ||
+            PyDict_SetItemString(dict, statfs_member[i][0], item) < 0)
+        {
+            Py_XDECREF(item);
+            Py_DecRef(dict);
+            return NULL;
+        }
+        DecRelease(&item);
+    }
+    return dict;
+}
+
+static PyMethodDef lazy_statfs_methods[] = {
+    { "_asdict", (PyCFunction) lazy_statfs_asdict, METH_NOARGS, "_asdict() -> dict\n" },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+
+static PyGetSetDef lazy_statfs_getset[STATFS_MEMBERS + 1];
+
+static PyType_Slot lazy_statfs_slots[] = {
+    { Py_tp_dealloc, (void *) lazy_statfs_dealloc },
+    { Py_tp_repr, (void *) lazy_statfs_repr },
+    { Py_tp_hash, (void *) lazy_statfs_hash },
+    { Py_tp_richcompare, (void *) lazy_statfs_richcompare },
+    { Py_tp_methods, (void *) lazy_statfs_methods },
+    { Py_tp_getset, (void *) lazy_statfs_getset },
+    { Py_sq_length, (void *) lazy_statfs_length },
+    { Py_sq_item, (void *) lazy_statfs_item },
+    { Py_mp_length, (void *) lazy_statfs_length },
+    { Py_mp_subscript, (void *) lazy_statfs_subscript },
+    { 0, NULL },
+};
+
+static PyType_Spec lazy_statfs_spec = {
+    .name = "statfs.lazy_statfs",
+    .basicsize = sizeof(lazy_statfs_object),
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = lazy_statfs_slots,
+};
+
+/*
+ * statfs_buffer: getfsstat(as_buffer=True) packs the table into
+ * fixed-width records (statfs_record, native byte order, no padding)
+ * and exports them through the buffer protocol.
+ */
+
+#define RECORD_FSTYPENAME  32
+#define RECORD_NAME        1024
+
+typedef struct statfs_record {
+    uint64_t f_flags;
+    uint64_t f_owner;
+    uint64_t f_type;
+    uint64_t f_iosize;
+    uint64_t f_bsize;
+    uint64_t f_blocks;
+    uint64_t f_bavail;
+    uint64_t f_bfree;
+    uint64_t f_files;
+    uint64_t f_ffree;
+    uint64_t f_frsize;  /* Linux, else 0 */
+    uint64_t f_favail;
+    uint64_t f_mntid;
+    int32_t f_fsid[2];
+    char f_fstypename[RECORD_FSTYPENAME];
+    char f_mntfromname[RECORD_NAME];
+    char f_mntonname[RECORD_NAME];
+} statfs_record;
+
+typedef struct statfs_record_field {
+    const char *name;
+    const char *format;  /* struct module */
+    const char *dtype;   /* numpy */
+    Py_ssize_t offset;
+    Py_ssize_t size;     /* of one element */
+    Py_ssize_t count;    /* elements, f_fsid: 2 */
+} statfs_record_field;
+
+#define record_field(s, n, f, d, c)                                     \
+    { #n, f, d, offsetof(s, n), sizeof(((s *) 0)->n) / (c), c }
+
+static const statfs_record_field statfs_record_fields[] = {
+    record_field(statfs_record, f_flags,       "Q", "u8", 1),
+    record_field(statfs_record, f_owner,       "Q", "u8", 1),
+    record_field(statfs_record, f_type,        "Q", "u8", 1),
+    record_field(statfs_record, f_iosize,      "Q", "u8", 1),
+    record_field(statfs_record, f_bsize,       "Q", "u8", 1),
+    record_field(statfs_record, f_blocks,      "Q", "u8", 1),
+    record_field(statfs_record, f_bavail,      "Q", "u8", 1),
+    record_field(statfs_record, f_bfree,       "Q", "u8", 1),
+    record_field(statfs_record, f_files,       "Q", "u8", 1),
+    record_field(statfs_record, f_ffree,       "Q", "u8", 1),
+    record_field(statfs_record, f_frsize,      "Q", "u8", 1),
+    record_field(statfs_record, f_favail,      "Q", "u8", 1),
+    record_field(statfs_record, f_mntid,       "Q", "u8", 1),
+    record_field(statfs_record, f_fsid,        "i", "i4", 2),
+    record_field(statfs_record, f_fstypename,  "32s", "S32", 1),
+    record_field(statfs_record, f_mntfromname, "1024s", "S1024", 1),
+    record_field(statfs_record, f_mntonname,   "1024s", "S1024", 1),
+    { NULL, NULL, NULL, 0, 0, 0 }, /* end */
+};
+
+/* Sampler.drain(): one statfs()/fstatfs() of one source */
+typedef struct sample_record {
+    uint64_t time;      /* CLOCK_REALTIME, ns */
+    uint32_t source;    /* index in paths, then fds */
+    int32_t error;      /* errno, 0 on success */
+    uint64_t f_bsize;   /* the unit of the block counters */
+    uint64_t f_blocks;
+    uint64_t f_bavail;
+    uint64_t f_bfree;
+    uint64_t f_ffree;
+    uint64_t f_files;
+} sample_record;
+
+static const statfs_record_field sample_record_fields[] = {
+    record_field(sample_record, time,     "Q", "u8", 1),
+    record_field(sample_record, source,   "I", "u4", 1),
+    record_field(sample_record, error,    "i", "i4", 1),
+    record_field(sample_record, f_bsize,  "Q", "u8", 1),
+    record_field(sample_record, f_blocks, "Q", "u8", 1),
+    record_field(sample_record, f_bavail, "Q", "u8", 1),
+    record_field(sample_record, f_bfree,  "Q", "u8", 1),
+    record_field(sample_record, f_ffree,  "Q", "u8", 1),
+    record_field(sample_record, f_files,  "Q", "u8", 1),
+    { NULL, NULL, NULL, 0, 0, 0 }, /* end */
+};
+
+#undef record_field
+
+/* "T{=Q:f_flags:...}", built at init */
+static char statfs_record_format[512];
+static char sample_record_format[256];
+
+static void
+pack_record(statfs_record *prec, const statfs_t *pmnt)
+{
+    memset(prec, 0, sizeof(*prec));
+    prec->f_flags = (uint64_t) pmnt->f_flags;
+#ifndef COMPILE_LINUX
+    prec->f_owner = (uint64_t) pmnt->f_owner;
+#endif /* !COMPILE_LINUX */
+    prec->f_type = (uint64_t) pmnt->f_type;
+    prec->f_iosize = (uint64_t) pmnt->f_iosize;
+    prec->f_bsize = (uint64_t) pmnt->f_bsize;
+    prec->f_blocks = (uint64_t) pmnt->f_blocks;
+    prec->f_bavail = (uint64_t) pmnt->f_bavail;
+    prec->f_bfree = (uint64_t) pmnt->f_bfree;
+    prec->f_files = (uint64_t) pmnt->f_files;
+    prec->f_ffree = (uint64_t) pmnt->f_ffree;
+#ifdef COMPILE_LINUX
+    prec->f_frsize = (uint64_t) pmnt->f_frsize;
+    prec->f_favail = (uint64_t) pmnt->f_favail;
+    prec->f_mntid = (uint64_t) pmnt->f_mntid;
+#endif /* COMPILE_LINUX */
+    prec->f_fsid[0] = (int32_t) pmnt->f_fsid.val[0];
+    prec->f_fsid[1] = (int32_t) pmnt->f_fsid.val[1];
+    strncpy(prec->f_fstypename, pmnt->f_fstypename, sizeof(prec->f_fstypename));
+    strncpy(prec->f_mntfromname, pmnt->f_mntfromname, sizeof(prec->f_mntfromname));
+    strncpy(prec->f_mntonname, pmnt->f_mntonname, sizeof(prec->f_mntonname));
+}
+
+typedef struct statfs_buffer_object {
+    PyObject_HEAD
+    PyObject *base;     /* owner of data for column views */
+    char *data;         /* owned when base is NULL */
+    const statfs_record_field *fields; /* of a record buffer, else NULL */
+    const char *format;
+    Py_ssize_t itemsize;
+    int ndim;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+} statfs_buffer_object;
+
+
+static statfs_buffer_object *
+new_statfs_buffer(PyTypeObject *type, PyObject *base, char *data)
+{
+    statfs_buffer_object *self = NULL;
+
+    if (!(self = PyObject_New(statfs_buffer_object, type)))
+        return NULL;
+    Py_XINCREF(base);
+    self->base = base;
+    self->data = data;
+    self->fields = NULL;
+    self->format = "B";
+    self->itemsize = 1;
+    self->ndim = 1;
+    self->shape[0] = self->shape[1] = 0;
+    self->strides[0] = self->strides[1] = 0;
+    return self;
+}
+
+static PyObject *
+build_statfs_buffer(statfs_state *st, const statfs_t *pbuf, int mcnt)
+{
+    statfs_buffer_object *self = NULL;
+    statfs_record *prec = NULL;
+    int i;
+
+    if (!(prec = (statfs_record *) malloc(sizeof(statfs_record) * (mcnt + 1))))
+        return PyErr_NoMemory();
+    for (i = 0; i < mcnt; ++i)
+        pack_record(prec + i, pbuf + i);
+    if (!(self = new_statfs_buffer(st->statfs_buffer_type, NULL, (char *) prec)))
+    {
+        free(prec);
+        return NULL;
+    }
+    self->fields = statfs_record_fields;
+    self->format = statfs_record_format;
+    self->itemsize = sizeof(statfs_record);
+    self->shape[0] = mcnt;
+    self->strides[0] = sizeof(statfs_record);
+    return (PyObject *) self;
+}
+
+static void
+statfs_buffer_dealloc(statfs_buffer_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    if (self->base)
+        Py_DecRef(self->base);
+    else
+        free(self->data);
+    PyObject_Free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+static int
+statfs_buffer_getbuffer(statfs_buffer_object *self, Py_buffer *view, int flags)
+{
+    int contiguous = (self->strides[0] == self->itemsize * (self->ndim > 1 ? self->shape[1] : 1));
+
+    if (flags & PyBUF_WRITABLE)
+    {
+        PyErr_SetString(PyExc_BufferError, "statfs buffer is read-only");
+        return -1;
+    }
+    if (!contiguous && (flags & PyBUF_STRIDES) != PyBUF_STRIDES)
+    {
+        PyErr_SetString(PyExc_BufferError, "statfs column is not contiguous");
+        return -1;
+    }
+    Py_IncRef((PyObject *) self);
+    view->obj = (PyObject *) self;
+    view->buf = self->data;
+    view->itemsize = self->itemsize;
+    view->len = self->itemsize * self->shape[0] * (self->ndim > 1 ? self->shape[1] : 1);
+    view->readonly = 1;
+    view->format = (flags & PyBUF_FORMAT) ? (char *) self->format : NULL;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t
+statfs_buffer_length(statfs_buffer_object *self)
+{
+    return self->shape[0];
+}
+
+static PyObject *
+statfs_buffer_column(statfs_buffer_object *self, PyObject *name)
+{
+    const statfs_record_field *pfield = NULL;
+    statfs_buffer_object *column = NULL;
+    const char *cname = NULL;
+
+    if (!self->fields)
+    {
+        PyErr_SetString(PyExc_TypeError, "not a statfs record buffer");
+        return NULL;
+    }
+    if (!(cname = PyUnicode_AsUTF8AndSize(name, NULL)))
+        return NULL;
+    for (pfield = self->fields; pfield->name; ++pfield)
+        if (strcmp(pfield->name, cname) == 0)
+            break;
+    if (!pfield->name)
+    {
+        PyErr_Format(PyExc_KeyError, "%R", name);
+        return NULL;
+    }
+    if (!(column = new_statfs_buffer(Py_TYPE(self), (PyObject *) self, self->data + pfield->offset)))
+        return NULL;
+    column->format = pfield->format;
+    column->itemsize = (pfield->format[0] == 'Q') ? 8 : pfield->size;
+    column->shape[0] = self->shape[0];
+    column->strides[0] = self->itemsize;
+    if (pfield->count > 1)
+    {
+        column->ndim = 2;
+        column->shape[1] = pfield->count;
+        column->strides[1] = pfield->size;
+    }
+    return (PyObject *) column;
+}
+
+static PyObject *
+statfs_buffer_get_format(statfs_buffer_object *self, void *closure)
+{
+    (void) closure;
+    return PyUnicode_FromString(self->format);
+}
+
+static PyObject *
+statfs_buffer_get_itemsize(statfs_buffer_object *self, void *closure)
+{
+    (void) closure;
+    return PyLong_FromSsize_t(self->itemsize);
+}
+
+static PyMethodDef statfs_buffer_methods[] = {
+    {
+        "column", (PyCFunction) statfs_buffer_column, METH_O,
+        "column(name: str) -> statfs_buffer\n"
+    },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+
+static PyGetSetDef statfs_buffer_getset[] = {
+    { "format", (getter) statfs_buffer_get_format, NULL, NULL, NULL },
+    { "itemsize", (getter) statfs_buffer_get_itemsize, NULL, NULL, NULL },
+    {NULL, NULL, NULL, NULL, NULL}, /* end */
+};
+
+static PyType_Slot statfs_buffer_slots[] = {
+    { Py_tp_dealloc, (void *) statfs_buffer_dealloc },
+    { Py_tp_methods, (void *) statfs_buffer_methods },
+    { Py_tp_getset, (void *) statfs_buffer_getset },
+    { Py_sq_length, (void *) statfs_buffer_length },
+    { Py_bf_getbuffer, (void *) statfs_buffer_getbuffer },
+    { 0, NULL },
+};
+
+static PyType_Spec statfs_buffer_spec = {
+    .name = "statfs.statfs_buffer",
+    .basicsize = sizeof(statfs_buffer_object),
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = statfs_buffer_slots,
+};
+
+/* the struct module format of a record, shared by all interpreters */
+static void
+prepare_format(const statfs_record_field *fields, char *format, size_t fsize)
+{
+    const statfs_record_field *pfield = NULL;
+    char *p = format;
+    char *end = format + fsize;
+
+    p += snprintf(p, end - p, "T{=");
+    for (pfield = fields; pfield->name; ++pfield)
+    {
+        if (pfield->count > 1)
+            p += snprintf(p, end - p, "(%d)", (int) pfield->count);
+        p += snprintf(p, end - p, "%s:%s:", pfield->format, pfield->name);
+    }
+    snprintf(p, end - p, "}");
+}
+
+/* adds <prefix>_dtype, <prefix>_format and <prefix>_size */
+static int
+prepare_layout(PyObject *module, const char *prefix, const statfs_record_field *fields,
+               const char *format, Py_ssize_t itemsize)
+{
+    const statfs_record_field *pfield = NULL;
+    PyObject *names = NULL;
+    PyObject *formats = NULL;
+    PyObject *offsets = NULL;
+    PyObject *dtype = NULL;
+    PyObject *item = NULL;
+    char name[64];
+    Py_ssize_t cnt = 0;
+    Py_ssize_t i = 0;
+
+    for (pfield = fields; pfield->name; ++pfield)
+        ++cnt;
+    if (!(names = PyTuple_New(cnt))) goto error;
+    if (!(formats = PyTuple_New(cnt))) goto error;
+    if (!(offsets = PyTuple_New(cnt))) goto error;
+    for (i = 0; i < cnt; ++i)
+    {
+        pfield = fields + i;
+        if (!(item = PyUnicode_FromString(pfield->name))) goto error;
+        TupleMoveItem(names, i, &item);
+        if (pfield->count > 1)
+            item = PyUnicode_FromFormat("(%d,)%s", (int) pfield->count, pfield->dtype);
+        else
+            item = PyUnicode_FromString(pfield->dtype);
+        if (!item) goto error;
+        TupleMoveItem(formats, i, &item);
+        if (!(item = PyLong_FromSsize_t(pfield->offset))) goto error;
+        TupleMoveItem(offsets, i, &item);
+    }
+    if (!(dtype = Py_BuildValue("{sOsOsOsn}", "names", names, "formats", formats,
+                                "offsets", offsets, "itemsize", itemsize)))
+        goto error;
+    snprintf(name, sizeof(name), "%s_dtype", prefix);
+    if (ModuleAddRelease(module, name, &dtype) < 0) goto error;
+    if (!(item = PyUnicode_FromString(format))) goto error;
+    snprintf(name, sizeof(name), "%s_format", prefix);
+    if (ModuleAddRelease(module, name, &item) < 0) goto error;
+    snprintf(name, sizeof(name), "%s_size", prefix);
+    if (PyModule_AddIntConstant(module, name, (long) itemsize) < 0) goto error;
+
+    Py_DecRef(names);
+    Py_DecRef(formats);
+    Py_DecRef(offsets);
+    return TRUE;
+
+error:
+    Py_XDECREF(item);
+    Py_XDECREF(dtype);
+    Py_XDECREF(names);
+    Py_XDECREF(formats);
+    Py_XDECREF(offsets);
+    return FALSE;
+}
+
+static int
+prepare_record(PyObject *module)
+{
+    statfs_state *st = module_state(module);
+
+    if (!(st->statfs_buffer_type = (PyTypeObject *)
+          PyType_FromModuleAndSpec(module, &statfs_buffer_spec, NULL)))
+        return FALSE;
+    if (!prepare_layout(module, "record", statfs_record_fields,
+                        statfs_record_format, sizeof(statfs_record)))
+        return FALSE;
+    if (!prepare_layout(module, "sample", sample_record_fields,
+                        sample_record_format, sizeof(sample_record)))
+        return FALSE;
+    return TRUE;
+}
+
+/*
+ * System calls, run without the GIL
+ */
+
+#if HAVE_GETFSSTAT
+static int
+sys_getfsstat(statfs_t **pbuf, int flags)
+{
+    int bufsize = 0;
+    int mcnt = 0;
+
+    *pbuf = NULL;
+    if ((mcnt = getfsstat(NULL, 0, flags)) < 0)
+        return -1;
+    bufsize = (int) (sizeof(statfs_t) * (mcnt + 1));
+    if (!(*pbuf = (statfs_t *) malloc(bufsize)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if ((mcnt = getfsstat(*pbuf, bufsize, flags)) < 0)
+    {
+        free(*pbuf);
+        *pbuf = NULL;
+    }
+    return mcnt;
+}
+#endif /* HAVE_GETFSSTAT */
+
+#if HAVE_GETMNTINFO
+static int
+sys_getmntinfo(statfs_t **pbuf, int flags)
+{
+#ifdef HAVE_GETMNTINFO_R_NP
+
+    *pbuf = NULL;
+    return getmntinfo_r_np(pbuf, flags);
+
+#else  /* !HAVE_GETMNTINFO_R_NP */
+
+    /* getmntinfo() returns a static buffer: copy it out under a lock */
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+    statfs_t *pmnt = NULL;
+    int mcnt = 0;
+    int err = 0;
+
+    *pbuf = NULL;
+    pthread_mutex_lock(&lock);
+    mcnt = getmntinfo(&pmnt, flags);
+    err = errno;
+    if (mcnt > 0)
+    {
+        if ((*pbuf = (statfs_t *) malloc(sizeof(statfs_t) * mcnt)))
+            memcpy(*pbuf, pmnt, sizeof(statfs_t) * mcnt);
+        else
+        {
+            mcnt = -1;
+            err = ENOMEM;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    errno = err;
+    return mcnt;
+
+#endif /* !HAVE_GETMNTINFO_R_NP */
+}
+#endif /* HAVE_GETMNTINFO */
+
+static void
+sys_refresh(statfs_t *pbuf, int mcnt)
+{
+#if defined(COMPILE_LINUX)
+    linux_refresh(pbuf, mcnt);
+#elif HAVE_STATFS
+    statfs_t buf;
+    int i;
+
+    for (i = 0; i < mcnt; ++i)
+        if (statfs(pbuf[i].f_mntonname, &buf) == 0)
+            memcpy(pbuf + i, &buf, sizeof(statfs_t));
+#else  /* !HAVE_STATFS */
+    (void) pbuf;
+    (void) mcnt;
+#endif /* !HAVE_STATFS */
+}
+
+/*
+ * Mount table cache for getmntinfo(cached=True).
+ *
+ * The table is re-read only when the kernel reports a change (Linux:
+ * POLLPRI on an open /proc/self/mountinfo; elsewhere every call counts
+ * as a change).  With MNT_NOWAIT the cached counters are returned as
+ * they are, otherwise they are refreshed with one statfs per mount.
+ * cache_generation counts the re-reads, cache_serial every update.
+ *
+ * The change notice is consumed before the table is read, with the lock
+ * dropped meanwhile: cache_want records the re-read a notice asks for,
+ * and only a successful store of that or a later re-read (cache_stored)
+ * settles it.  A failed re-read leaves the cache stale, and a re-read
+ * finishing after a newer one has been stored is discarded.
+ *
+ * On Linux statfs() and fstatfs() look their names up here by mount ID
+ * through an open-addressing index; a table they re-read has names but
+ * no counters until getmntinfo() fills them.
+ */
+
+#if HAVE_GETMNTINFO
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static statfs_t *cache_pbuf = NULL;
+static int cache_count = 0;
+static unsigned long cache_generation = 0;
+static unsigned long cache_serial = 0;
+static int cache_fd = -1;
+static int cache_counted = FALSE;
+static unsigned long cache_reads = 0;   /* re-reads started */
+static unsigned long cache_stored = 0;  /* the re-read in cache_pbuf */
+static unsigned long cache_want = 0;    /* the first re-read to satisfy */
+#ifdef COMPILE_LINUX
+static int *cache_ids = NULL;  /* index of cache_pbuf by f_mntid, -1 free */
+static unsigned int cache_ids_mask = 0;
+#endif /* LINUX */
+
+/* cache_lock held */
+static int
+cache_changed(void)
+{
+#ifdef COMPILE_LINUX
+    static struct stat last;
+    struct pollfd pfd;
+    struct stat st;
+    int fake = FALSE;
+
+    /* a plain file signals nothing: compare its stat instead */
+    pthread_mutex_lock(&linux_source_lock);
+    if ((fake = (linux_source != NULL)) && stat(linux_source, &st) < 0)
+        memset(&st, 0, sizeof(st));
+    pthread_mutex_unlock(&linux_source_lock);
+    if (fake)
+    {
+        fake = (st.st_ino == last.st_ino && st.st_size == last.st_size &&
+                st.st_mtim.tv_sec == last.st_mtim.tv_sec &&
+                st.st_mtim.tv_nsec == last.st_mtim.tv_nsec);
+        last = st;
+        return !fake;
+    }
+    if (cache_fd < 0)
+    {
+        /* opened before the table is read: later changes are signalled */
+        cache_fd = open(LINUX_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+        return TRUE;
+    }
+    pfd.fd = cache_fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) < 0)
+        return TRUE;
+    return (pfd.revents & (POLLPRI | POLLERR)) != 0;
+#else  /* !LINUX */
+    return TRUE;
+#endif /* !LINUX */
+}
+
+#ifdef COMPILE_LINUX
+
+#define CACHE_ID_HASH(id)  ((unsigned int) ((id) * 2654435761u))
+
+/* cache_lock held; without memory the lookups scan the table */
+static void
+cache_index(void)
+{
+    unsigned int size = 16;
+    unsigned int h;
+    int i;
+
+    free(cache_ids);
+    cache_ids = NULL;
+    cache_ids_mask = 0;
+    while (size < (unsigned int) cache_count * 2)
+        size *= 2;
+    if (!(cache_ids = (int *) malloc(sizeof(int) * size)))
+        return;
+    memset(cache_ids, 0xff, sizeof(int) * size);
+    cache_ids_mask = size - 1;
+    for (i = 0; i < cache_count; ++i)
+    {
+        h = CACHE_ID_HASH(cache_pbuf[i].f_mntid) & cache_ids_mask;
+        while (cache_ids[h] >= 0)
+            h = (h + 1) & cache_ids_mask;
+        cache_ids[h] = i;
+    }
+}
+
+/* cache_lock held */
+static const statfs_t *
+cache_find_id(uint64_t id)
+{
+    unsigned int h;
+    int i;
+
+    if (!cache_ids)
+    {
+        for (i = 0; i < cache_count; ++i)
+        {
+            if (cache_pbuf[i].f_mntid == id)
+                return &cache_pbuf[i];
+        }
+        return NULL;
+    }
+    for (h = CACHE_ID_HASH(id) & cache_ids_mask; cache_ids[h] >= 0; h = (h + 1) & cache_ids_mask)
+    {
+        if (cache_pbuf[cache_ids[h]].f_mntid == id)
+            return &cache_pbuf[cache_ids[h]];
+    }
+    return NULL;
+}
+
+#endif /* LINUX */
+
+/* cache_lock held; whether a re-read is due */
+static int
+cache_stale(void)
+{
+    if (cache_changed())
+        cache_want = cache_reads + 1;
+    return !cache_pbuf || cache_stored < cache_want;
+}
+
+/* cache_lock held; takes ptab of re-read number `read`, FALSE if it is older */
+static int
+cache_store(statfs_t *ptab, int mcnt, int counted, unsigned long read)
+{
+    if (read <= cache_stored)
+    {
+        free(ptab);
+        return FALSE;
+    }
+    free(cache_pbuf);
+    cache_pbuf = ptab;
+    cache_count = mcnt;
+    cache_counted = counted;
+    cache_stored = read;
+    ++cache_generation;
+    ++cache_serial;
+#ifdef COMPILE_LINUX
+    cache_index();
+#endif /* LINUX */
+    return TRUE;
+}
+
+/* cache_lock held; the re-reads under way are discarded too */
+static void
+cache_drop(void)
+{
+    free(cache_pbuf);
+    cache_pbuf = NULL;
+    cache_count = 0;
+    cache_counted = FALSE;
+    cache_stored = cache_reads;
+    cache_want = cache_reads + 1;
+    ++cache_serial;
+#ifdef COMPILE_LINUX
+    cache_index();
+#endif /* LINUX */
+}
+
+#ifdef COMPILE_LINUX
+
+/* without the GIL; the names of the mount pmnt->f_mntid */
+static int
+cache_lookup_id(statfs_t *pmnt)
+{
+    const statfs_t *pent = NULL;
+    statfs_t *ptab = NULL;
+    unsigned long read = 0;
+    int mcnt = 0;
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_stale())
+    {
+        read = ++cache_reads;
+        pthread_mutex_unlock(&cache_lock);
+        if ((mcnt = linux_read_mountinfo(&ptab)) < 0)
+            return FALSE;
+        pthread_mutex_lock(&cache_lock);
+        cache_store(ptab, mcnt, FALSE, read);
+    }
+    if (cache_pbuf && (pent = cache_find_id(pmnt->f_mntid)))
+        linux_copy_entry(pmnt, pent);
+    pthread_mutex_unlock(&cache_lock);
+    return pent != NULL;
+}
+
+#endif /* LINUX */
+
+/*
+ * Without the GIL; *pbuf gets a private copy of the cache, pruned by
+ * the names of filter (or NULL) before its counters are refreshed.
+ */
+static int
+cache_getmntinfo(statfs_t **pbuf, int flags, unsigned long *pserial,
+                 const statfs_filter *filter)
+{
+    statfs_t *ptab = NULL;
+    unsigned long serial = 0;
+    unsigned long read = 0;
+    int counted = TRUE;
+    int mcnt = 0;
+    int fcnt = 0;
+
+    *pbuf = NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_stale())
+    {
+        read = ++cache_reads;
+        pthread_mutex_unlock(&cache_lock);
+#ifdef COMPILE_LINUX
+        /* filtered: the names only, the dropped mounts are never refreshed */
+        if (filter && filter->active)
+        {
+            mcnt = linux_read_mountinfo(&ptab);
+            counted = FALSE;
+        }
+        else
+#endif /* LINUX */
+            mcnt = sys_getmntinfo(&ptab, flags);
+        if (mcnt < 0)
+            return -1;
+        pthread_mutex_lock(&cache_lock);
+        if (cache_store(ptab, mcnt, counted, read) && counted)
+            flags = MNT_NOWAIT; /* the counters are fresh */
+    }
+    if (!cache_pbuf)
+    {
+        /* dropped by mount_source() meanwhile */
+        pthread_mutex_unlock(&cache_lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    if (!cache_counted)
+        flags = MNT_WAIT;       /* names only, from a statfs() lookup */
+    serial = cache_serial;
+    mcnt = cache_count;
+    if ((*pbuf = (statfs_t *) malloc(sizeof(statfs_t) * (mcnt + 1))))
+        memcpy(*pbuf, cache_pbuf, sizeof(statfs_t) * mcnt);
+    pthread_mutex_unlock(&cache_lock);
+
+    if (!*pbuf)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    fcnt = filter_apply(filter, *pbuf, mcnt, FALSE);
+    if (flags != MNT_NOWAIT)
+    {
+        sys_refresh(*pbuf, fcnt);
+        pthread_mutex_lock(&cache_lock);
+        /* a pruned copy no longer lines up with the cache */
+        if (serial == cache_serial && fcnt == mcnt)
+        {
+            memcpy(cache_pbuf, *pbuf, sizeof(statfs_t) * mcnt);
+            cache_counted = TRUE;
+            serial = ++cache_serial;
+        }
+        pthread_mutex_unlock(&cache_lock);
+    }
+    *pserial = serial;
+    return fcnt;
+}
+
+#endif /* HAVE_GETMNTINFO */
+
+/*
+ * Jobs: a system call with its arguments and results.
+ *
+ * With a timeout the job runs on a detached helper thread.  When the
+ * deadline passes the caller abandons the job and the helper frees it
+ * once the system call returns; until then it is counted as stuck.
+ */
+
+#define JOB_STATFS      0
+#define JOB_FSTATFS     1
+#define JOB_GETFSSTAT   2
+#define JOB_GETMNTINFO  3
+#define JOB_MNTCACHE    4
+#define JOB_MNTSOURCE   5 /* getmntinfo(pid=, root=, source=) */
+#define JOB_STATFSAT    6 /* statfs(dir_fd=) */
+
+#define MAX_STUCK_THREADS  16
+
+typedef struct statfs_job {
+    int kind;
+    int flags;
+    int fd;
+    int owns_fd;
+    char *path;
+    char *root;
+    double deadline;    /* LINUX: JOB_GETFSSTAT, per mount */
+    statfs_filter *filter;  /* a copy, or NULL */
+
+    statfs_t buf;
+    statfs_t *pbuf;
+    unsigned long serial;
+    int result;
+    int error;
+
+    int done;
+    int abandoned;
+    pthread_cond_t cond;
+} statfs_job;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static int job_stuck = 0;
+
+static statfs_job *
+job_new(int kind)
+{
+    statfs_job *job = NULL;
+
+    if (!(job = (statfs_job *) calloc(1, sizeof(statfs_job))))
+    {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    job->kind = kind;
+    job->fd = -1;
+#ifdef COMPILE_LINUX
+    job->deadline = REFRESH_DEADLINE;
+#endif /* COMPILE_LINUX */
+    cond_init_monotonic(&job->cond);
+    return job;
+}
+
+static void
+job_free(statfs_job *job)
+{
+    if (job->owns_fd)
+        close(job->fd);
+    free(job->path);
+    free(job->root);
+    free(job->pbuf);
+    free(job->filter);
+    pthread_cond_destroy(&job->cond);
+    free(job);
+}
+
+/* a copy of filter into the job: the rows it drops are never refreshed */
+static int
+job_filter(statfs_job *job, const statfs_filter *filter)
+{
+    if (!filter->active)
+        return TRUE;
+    if (!(job->filter = filter_copy(filter)))
+    {
+        PyErr_NoMemory();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+job_call(statfs_job *job)
+{
+    errno = ENOSYS;
+    job->result = -1;
+
+    switch (job->kind)
+    {
+#if HAVE_STATFS
+    case JOB_STATFS:
+        job->result = statfs_path_r(job->path, &job->buf, NULL, 0);
+        break;
+    case JOB_FSTATFS:
+        job->result = statfs_fd_r(job->fd, &job->buf, NULL, 0);
+        break;
+    case JOB_STATFSAT:
+        job->result = statfs_at_r(job->fd, job->path, &job->buf);
+        break;
+#endif /* HAVE_STATFS */
+#if HAVE_GETFSSTAT
+    case JOB_GETFSSTAT:
+#ifdef COMPILE_LINUX
+        job->result = linux_getfsstat(&job->pbuf, job->flags, job->deadline, job->filter);
+#else  /* !COMPILE_LINUX */
+        job->result = sys_getfsstat(&job->pbuf, job->flags);
+#endif /* !COMPILE_LINUX */
+        break;
+#endif /* HAVE_GETFSSTAT */
+#if HAVE_GETMNTINFO
+    case JOB_GETMNTINFO:
+#ifdef COMPILE_LINUX
+        job->result = linux_getmntinfo(&job->pbuf, job->filter);
+#else  /* !COMPILE_LINUX */
+        job->result = sys_getmntinfo(&job->pbuf, job->flags);
+#endif /* !COMPILE_LINUX */
+        break;
+    case JOB_MNTCACHE:
+        job->result = cache_getmntinfo(&job->pbuf, job->flags, &job->serial, job->filter);
+        break;
+#endif /* HAVE_GETMNTINFO */
+#ifdef COMPILE_LINUX
+    case JOB_MNTSOURCE:
+        job->result = linux_getmntinfo_at(&job->pbuf, job->path, job->root, job->filter);
+        break;
+#endif /* COMPILE_LINUX */
+    default:
+        break;
+    }
+    job->error = (job->result < 0) ? errno : 0;
+}
+
+static void *
+job_main(void *arg)
+{
+    statfs_job *job = (statfs_job *) arg;
+    int abandoned = FALSE;
+
+    job_call(job);
+
+    pthread_mutex_lock(&job_lock);
+    job->done = TRUE;
+    abandoned = job->abandoned;
+    if (abandoned)
+        --job_stuck;
+    else
+        pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job_lock);
+
+    if (abandoned)
+        job_free(job);
+    return NULL;
+}
+
+/*
+ * Run the job, on a helper thread when timeout >= 0.
+ * Returns FALSE with an exception set; the job is then no longer ours.
+ */
+static int
+job_run(statfs_job *job, double timeout)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    double deadline = 0;
+    int done = FALSE;
+    int err = 0;
+
+    if (timeout < 0)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        job_call(job);
+        Py_END_ALLOW_THREADS
+    }
+    else
+    {
+        pthread_mutex_lock(&job_lock);
+        err = (job_stuck >= MAX_STUCK_THREADS);
+        pthread_mutex_unlock(&job_lock);
+        if (err)
+        {
+            job_free(job);
+            PyErr_SetString(PyExc_TimeoutError, "too many stuck statfs threads");
+            return FALSE;
+        }
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        err = pthread_create(&thread, &attr, job_main, job);
+        pthread_attr_destroy(&attr);
+        if (err)
+        {
+            job_free(job);
+            errno = err;
+            PyErr_SetFromErrno(PyExc_OSError);
+            return FALSE;
+        }
+
+        if (timeout > 1e8)
+            timeout = 1e8;
+        deadline = clock_monotonic() + timeout;
+
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&job_lock);
+        while (!job->done)
+            if (cond_wait_until(&job->cond, &job_lock, deadline) == ETIMEDOUT)
+                break;
+        done = job->done;
+        if (!done)
+        {
+            job->abandoned = TRUE;
+            ++job_stuck;
+        }
+        pthread_mutex_unlock(&job_lock);
+        Py_END_ALLOW_THREADS
+
+        if (!done)
+        {
+            PyErr_SetString(PyExc_TimeoutError, "statfs timed out");
+            return FALSE;
+        }
+    }
+
+    if (job->result < 0)
+    {
+        errno = job->error;
+        PyErr_SetFromErrno(PyExc_OSError);
+        job_free(job);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int
+parse_timeout(PyObject *value, double *timeout)
+{
+    *timeout = -1.0;
+    if (!value || value == Py_None)
+        return TRUE;
+    *timeout = PyFloat_AsDouble(value);
+    if (*timeout == -1.0 && PyErr_Occurred())
+        return FALSE;
+    if (*timeout < 0 || *timeout != *timeout)
+    {
+        PyErr_SetString(PyExc_ValueError, "timeout must be a non-negative number");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * A path as os.fspath() takes it: str (filesystem encoding), bytes as
+ * they are, or os.PathLike.  Embedded NULs raise ValueError.  *pbytes
+ * holds the encoded path.
+ */
+static const char *
+parse_path(PyObject *obj, PyObject **pbytes)
+{
+    *pbytes = NULL;
+    if (!PyUnicode_FSConverter(obj, pbytes))
+        return NULL;
+    return PyBytes_AS_STRING(*pbytes);
+}
+
+#ifdef COMPILE_LINUX
+/* parse_path() of a keyword argument: a TypeError names it */
+static const char *
+parse_path_arg(const char *name, PyObject *obj, PyObject **pbytes)
+{
+    const char *path = NULL;
+
+    if (!(path = parse_path(obj, pbytes)) && PyErr_ExceptionMatches(PyExc_TypeError))
+        PyErr_Format(PyExc_TypeError, "%s must be str, bytes or os.PathLike, not %.200s",
+                     name, Py_TYPE(obj)->tp_name);
+    return path;
+}
+#endif /* COMPILE_LINUX */
+
+/* deadline=: unchanged when absent, None for none (-1) */
+static int
+parse_deadline(PyObject *value, double *deadline)
+{
+    if (!value)
+        return TRUE;
+    *deadline = -1.0;
+    if (value == Py_None)
+        return TRUE;
+    *deadline = PyFloat_AsDouble(value);
+    if (*deadline == -1.0 && PyErr_Occurred())
+        return FALSE;
+    /* 0 would mark every call lost */
+    if (!(*deadline > 0))
+    {
+        PyErr_SetString(PyExc_ValueError, "deadline must be a positive number");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static PyObject *
+build_statfs_list(statfs_state *st, statfs_t *pbuf, int mcnt, int lazy, const statfs_projection *proj)
+{
+    PyObject *plist = NULL;
+    PyObject *pinfo = NULL;
+    int i = 0;
+
+    if (!(plist = PyList_New(mcnt)))
+        return NULL;
+    for (i = 0; i < mcnt; ++i)
+    {
+        if (!(pinfo = build_record(st, pbuf + i, lazy, proj)))
+        {
+            Py_DecRef(plist);
+            return NULL;
+        }
+        ListMoveItem(plist, (Py_ssize_t)i, &pinfo);
+    }
+    return plist;
+}
+
+/*
+ * Batches: one GIL release for all items, the calls spread over up to
+ * `workers` native threads pulling items from a shared cursor.
+ */
+
+#define BATCH_WORKERS      4
+#define MAX_BATCH_WORKERS  64
+
+typedef struct statfs_batch {
+    Py_ssize_t count;
+    const char **paths;
+    int *fds;
+    statfs_t *results;
+    int *errors;
+
+    Py_ssize_t next;
+    pthread_mutex_t lock;
+
+    statfs_t *ptab; /* LINUX: mount table shared by all items */
+    int tcnt;
+} statfs_batch;
+
+static int
+batch_init(statfs_batch *batch, Py_ssize_t count, int usefd)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->count = count;
+    pthread_mutex_init(&batch->lock, NULL);
+    if (usefd)
+        batch->fds = (int *) calloc(count + 1, sizeof(int));
+    else
+        batch->paths = (const char **) calloc(count + 1, sizeof(const char *));
+    batch->results = (statfs_t *) calloc(count + 1, sizeof(statfs_t));
+    batch->errors = (int *) calloc(count + 1, sizeof(int));
+    if ((batch->fds || batch->paths) && batch->results && batch->errors)
+        return TRUE;
+    PyErr_NoMemory();
+    return FALSE;
+}
+
+static void
+batch_exit(statfs_batch *batch)
+{
+    free(batch->paths);
+    free(batch->fds);
+    free(batch->results);
+    free(batch->errors);
+    pthread_mutex_destroy(&batch->lock);
+}
+
+static void *
+batch_main(void *arg)
+{
+    statfs_batch *batch = (statfs_batch *) arg;
+    statfs_t *pmnt = NULL;
+    Py_ssize_t i = 0;
+    int res = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&batch->lock);
+        i = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->count)
+            break;
+
+        pmnt = batch->results + i;
+        if (batch->paths)
+            res = statfs_path_r(batch->paths[i], pmnt, batch->ptab, batch->tcnt);
+        else
+            res = statfs_fd_r(batch->fds[i], pmnt, batch->ptab, batch->tcnt);
+        batch->errors[i] = (res < 0) ? errno : 0;
+    }
+    return NULL;
+}
+
+/* without the GIL */
+static void
+batch_run(statfs_batch *batch, int workers)
+{
+    pthread_t thread[MAX_BATCH_WORKERS];
+    int started = 0;
+    int i;
+
+#ifdef COMPILE_LINUX
+    if ((batch->tcnt = linux_read_mountinfo(&batch->ptab)) < 0)
+        batch->tcnt = 0;
+#endif /* COMPILE_LINUX */
+
+    if (workers > batch->count)
+        workers = (int) batch->count;
+    for (i = 1; i < workers; ++i)
+        if (pthread_create(&thread[started], NULL, batch_main, batch) == 0)
+            ++started;
+    batch_main(batch);
+    for (i = 0; i < started; ++i)
+        pthread_join(thread[i], NULL);
+
+    free(batch->ptab);
+    batch->ptab = NULL;
+}
+
+static int
+parse_workers(int workers)
+{
+    if (workers < 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "workers must be positive");
+        return -1;
+    }
+    return (workers > MAX_BATCH_WORKERS) ? MAX_BATCH_WORKERS : workers;
+}
+
+/* seq holds the paths for the errors' filename */
+static PyObject *
+build_batch(statfs_state *st, statfs_batch *batch, PyObject *seq, int lazy, const statfs_projection *proj)
+{
+    PyObject *plist = NULL;
+    PyObject *pinfo = NULL;
+    Py_ssize_t i = 0;
+    int err = 0;
+
+    if (!(plist = PyList_New(batch->count)))
+        return NULL;
+    for (i = 0; i < batch->count; ++i)
+    {
+        if (!(err = batch->errors[i]))
+            pinfo = build_record(st, batch->results + i, lazy, proj);
+        else if (batch->paths)
+            pinfo = PyObject_CallFunction(PyExc_OSError, "isO", err, strerror(err),
+                                          PySequence_Fast_GET_ITEM(seq, i));
+        else
+            pinfo = PyObject_CallFunction(PyExc_OSError, "is", err, strerror(err));
+        if (!pinfo)
+        {
+            Py_DecRef(plist);
+            return NULL;
+        }
+        ListMoveItem(plist, i, &pinfo);
+    }
+    return plist;
+}
+
+/*
+ * Mount tables in a stable order, for diffs: by mount point, then by
+ * the mounted filesystem (Linux: device number, elsewhere f_fsid).
+ */
+
+static int
+mount_compare(const statfs_t *a, const statfs_t *b)
+{
+    int c = strcmp(a->f_mntonname, b->f_mntonname);
+
+    if (c)
+        return c;
+#ifdef COMPILE_LINUX
+    return (a->l_dev > b->l_dev) - (a->l_dev < b->l_dev);
+#else  /* !LINUX */
+    return memcmp(&a->f_fsid, &b->f_fsid, sizeof(a->f_fsid));
+#endif /* !LINUX */
+}
+
+static int
+mount_compare_ref(const void *a, const void *b)
+{
+    return mount_compare(*(const statfs_t * const *) a, *(const statfs_t * const *) b);
+}
+
+static const statfs_t **
+mount_sort(const statfs_t *pbuf, int mcnt)
+{
+    const statfs_t **pref = NULL;
+    int i;
+
+    if (!(pref = (const statfs_t **) malloc(sizeof(statfs_t *) * (mcnt + 1))))
+        return NULL;
+    for (i = 0; i < mcnt; ++i)
+        pref[i] = pbuf + i;
+    qsort(pref, mcnt, sizeof(statfs_t *), mount_compare_ref);
+    return pref;
+}
+
+/*
+ * MountWatcher: a pollable fd that becomes readable when the mount
+ * table changes (Linux: an epoll set waiting for POLLPRI on
+ * /proc/self/mountinfo, BSD: a kqueue with EVFILT_FS), and a diff of
+ * the mount table against the previous snapshot.
+ */
+
+#if defined(COMPILE_LINUX) || (defined(EVFILT_FS) && HAVE_GETFSSTAT)
+#define HAVE_MOUNT_WATCHER 1
+#endif
+
+/*
+ * The state word, changed only by compare-and-swap: read() and next()
+ * take IDLE to BUSY and back; close() takes IDLE to CLOSED, or BUSY to
+ * CLOSING for the reader to close as it leaves.  Whoever makes it CLOSED
+ * releases fd, source and pbuf, once.
+ */
+#define WATCH_IDLE     0
+#define WATCH_BUSY     1
+#define WATCH_CLOSING  2
+#define WATCH_CLOSED   3
+
+typedef struct mount_watcher_object {
+    PyObject_HEAD
+    int fd;       /* epoll / kqueue */
+    int source;   /* LINUX: /proc/self/mountinfo */
+    int flags;
+    statfs_t *pbuf;
+    int mcnt;
+    int state;
+    statfs_state *st;   /* of the defining module */
+} mount_watcher_object;
+
+typedef struct mount_diff {
+    const statfs_t **added;     /* in the new table */
+    const statfs_t **removed;   /* in the old table */
+    const statfs_t **remounted; /* in the new table */
+    int nadded;
+    int nremoved;
+    int nremounted;
+} mount_diff;
+
+
+static PyStructSequence_Field mount_changes_fields[] = {
+    { "added", "mounts that appeared" },
+    { "removed", "mounts that went away" },
+    { "remounted", "mounts whose f_flags changed" },
+    { NULL, NULL },
+};
+
+static PyStructSequence_Desc mount_changes_desc = {
+    .name = "statfs.mount_changes",
+    .doc = "MountWatcher.read() result",
+    .fields = mount_changes_fields,
+    .n_in_sequence = 3,
+};
+
+/* without the GIL */
+static int
+watch_snapshot(statfs_t **pbuf, int flags)
+{
+#if defined(COMPILE_LINUX)
+    (void) flags;
+    return linux_read_mountinfo(pbuf); /* statfs only what changed */
+#elif HAVE_GETFSSTAT
+    return sys_getfsstat(pbuf, flags);
+#else
+    (void) flags;
+    *pbuf = NULL;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+#ifdef COMPILE_LINUX
+/*
+ * The counters only: the table becomes the next baseline, and statfs()
+ * merges the superblock bits into f_flags, which mountinfo does not.
+ */
+static void
+watch_refresh(statfs_t *pmnt)
+{
+    uint64_t flags = pmnt->f_flags;
+
+    linux_refresh(pmnt, 1);
+    pmnt->f_flags = flags;
+}
+#endif /* COMPILE_LINUX */
+
+/* without the GIL */
+static int
+watch_diff(mount_diff *diff, const statfs_t *pold, int ocnt,
+           const statfs_t *pnew, int ncnt)
+{
+    const statfs_t **oref = NULL;
+    const statfs_t **nref = NULL;
+    int i = 0;
+    int j = 0;
+    int c = 0;
+
+    memset(diff, 0, sizeof(*diff));
+    oref = mount_sort(pold, ocnt);
+    nref = mount_sort(pnew, ncnt);
+    diff->added = (const statfs_t **) malloc(sizeof(statfs_t *) * (ncnt + 1));
+    diff->removed = (const statfs_t **) malloc(sizeof(statfs_t *) * (ocnt + 1));
+    diff->remounted = (const statfs_t **) malloc(sizeof(statfs_t *) * (ncnt + 1));
+    if (!oref || !nref || !diff->added || !diff->removed || !diff->remounted)
+    {
+        free(oref);
+        free(nref);
+        free(diff->added);
+        free(diff->removed);
+        free(diff->remounted);
+        memset(diff, 0, sizeof(*diff));
+        return FALSE;
+    }
+
+    while (i < ocnt || j < ncnt)
+    {
+        if (i >= ocnt)
+            c = 1;
+        else if (j >= ncnt)
+            c = -1;
+        else
+            c = mount_compare(oref[i], nref[j]);
+
+        if (c < 0)
+            diff->removed[diff->nremoved++] = oref[i++];
+        else if (c > 0)
+            diff->added[diff->nadded++] = nref[j++];
+        else
+        {
+            if (oref[i]->f_flags != nref[j]->f_flags)
+                diff->remounted[diff->nremounted++] = nref[j];
+            ++i;
+            ++j;
+        }
+    }
+
+#ifdef COMPILE_LINUX
+    for (i = 0; i < diff->nadded; ++i)
+        watch_refresh((statfs_t *) diff->added[i]);
+    for (i = 0; i < diff->nremounted; ++i)
+        watch_refresh((statfs_t *) diff->remounted[i]);
+#endif /* COMPILE_LINUX */
+
+    free(oref);
+    free(nref);
+    return TRUE;
+}
+
+static void
+watch_diff_free(mount_diff *diff)
+{
+    free(diff->added);
+    free(diff->removed);
+    free(diff->remounted);
+}
+
+static PyObject *
+build_statfs_refs(statfs_state *st, const statfs_t **pref, int cnt)
+{
+    PyObject *plist = NULL;
+    PyObject *pinfo = NULL;
+    int i;
+
+    if (!(plist = PyList_New(cnt)))
+        return NULL;
+    for (i = 0; i < cnt; ++i)
+    {
+        if (!(pinfo = build_statfs(st, pref[i])))
+        {
+            Py_DecRef(plist);
+            return NULL;
+        }
+        ListMoveItem(plist, i, &pinfo);
+    }
+    return plist;
+}
+
+static PyObject *
+build_mount_changes(statfs_state *st, const mount_diff *diff)
+{
+    PyObject *changes = NULL;
+    PyObject *item = NULL;
+
+    if (!(changes = PyStructSequence_New(st->mount_changes_type)))
+        return NULL;
+    if (!(item = build_statfs_refs(st, diff->added, diff->nadded)))
+        goto error;
+    PyStructSequence_SET_ITEM(changes, 0, item);
+    if (!(item = build_statfs_refs(st, diff->removed, diff->nremoved)))
+        goto error;
+    PyStructSequence_SET_ITEM(changes, 1, item);
+    if (!(item = build_statfs_refs(st, diff->remounted, diff->nremounted)))
+        goto error;
+    PyStructSequence_SET_ITEM(changes, 2, item);
+    return changes;
+
+error:
+    Py_DecRef(changes);
+    return NULL;
+}
+
+/* without the GIL */
+static void
+watch_drain(mount_watcher_object *self)
+{
+#if defined(COMPILE_LINUX)
+    struct epoll_event events[4];
+
+    while (epoll_wait(self->fd, events, 4, 0) > 0)
+        ;
+#elif defined(HAVE_MOUNT_WATCHER)
+    struct timespec zero = { 0, 0 };
+    struct kevent events[4];
+
+    while (kevent(self->fd, NULL, 0, events, 4, &zero) > 0)
+        ;
+#else
+    (void) self;
+#endif
+}
+
+static int
+watch_open(mount_watcher_object *self)
+{
+#if defined(COMPILE_LINUX)
+    struct epoll_event event;
+
+    if ((self->source = open(LINUX_MOUNTINFO, O_RDONLY | O_CLOEXEC)) < 0)
+        return FALSE;
+    if ((self->fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return FALSE;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLPRI;
+    return epoll_ctl(self->fd, EPOLL_CTL_ADD, self->source, &event) == 0;
+#elif defined(HAVE_MOUNT_WATCHER)
+    struct kevent event;
+
+    if ((self->fd = kqueue()) < 0)
+        return FALSE;
+    fcntl(self->fd, F_SETFD, FD_CLOEXEC);
+    EV_SET(&event, 0, EVFILT_FS, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    return kevent(self->fd, &event, 1, NULL, 0, NULL) == 0;
+#else
+    (void) self;
+    errno = ENOSYS;
+    return FALSE;
+#endif
+}
+
+/* fd and source keep their numbers: the state tells they are closed */
+static void
+watch_close(mount_watcher_object *self)
+{
+    if (self->fd >= 0)
+        close(self->fd);
+    if (self->source >= 0)
+        close(self->source);
+    free(self->pbuf);
+    self->pbuf = NULL;
+    self->mcnt = 0;
+}
+
+static PyObject *
+mount_watcher_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "flags", NULL };
+
+    mount_watcher_object *self = NULL;
+    int flags = MNT_NOWAIT;
+    int mcnt = 0;
+    int ok = FALSE;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", keywords, &flags))
+        return NULL;
+    if (!(self = (mount_watcher_object *) type->tp_alloc(type, 0)))
+        return NULL;
+    self->st = type_state(type);
+    self->fd = -1;
+    self->source = -1;
+    self->flags = flags;
+
+    Py_BEGIN_ALLOW_THREADS
+    if ((ok = watch_open(self)))
+        ok = ((mcnt = watch_snapshot(&self->pbuf, flags)) >= 0);
+    Py_END_ALLOW_THREADS
+
+    if (!ok)
+    {
+        PyErr_SetFromErrno(errno == ENOSYS ? PyExc_NotImplementedError : PyExc_OSError);
+        Py_DecRef((PyObject *) self);
+        return NULL;
+    }
+    self->mcnt = mcnt;
+    return (PyObject *) self;
+}
+
+static void
+mount_watcher_dealloc(mount_watcher_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    if (self->state != WATCH_CLOSED)
+        watch_close(self);
+    type->tp_free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+static int
+mount_watcher_closed(mount_watcher_object *self)
+{
+    return __atomic_load_n(&self->state, __ATOMIC_ACQUIRE) >= WATCH_CLOSING;
+}
+
+static int
+mount_watcher_check(mount_watcher_object *self)
+{
+    if (!mount_watcher_closed(self))
+        return TRUE;
+    PyErr_SetString(PyExc_ValueError, "I/O operation on closed MountWatcher");
+    return FALSE;
+}
+
+static PyObject *
+mount_watcher_fileno(mount_watcher_object *self, PyObject *args)
+{
+    (void) args;
+
+    if (!mount_watcher_check(self))
+        return NULL;
+    return PyLong_FromLong(self->fd);
+}
+
+/* read() and next() use fd and pbuf without the GIL */
+static int
+mount_watcher_enter_busy(mount_watcher_object *self, const char *name)
+{
+    int state = WATCH_IDLE;
+
+    if (__atomic_compare_exchange_n(&self->state, &state, WATCH_BUSY, FALSE,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        return TRUE;
+    if (state == WATCH_BUSY)
+        PyErr_Format(PyExc_RuntimeError, "%s() already in progress", name);
+    else
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed MountWatcher");
+    return FALSE;
+}
+
+/* a close() meanwhile was left to the reader: done as it leaves */
+static void
+mount_watcher_leave(mount_watcher_object *self)
+{
+    int state = WATCH_BUSY;
+
+    if (__atomic_compare_exchange_n(&self->state, &state, WATCH_IDLE, FALSE,
+                                    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        return;
+    /* CLOSING: no one else touches the descriptors any more */
+    watch_close(self);
+    __atomic_store_n(&self->state, WATCH_CLOSED, __ATOMIC_RELEASE);
+}
+
+static void
+mount_watcher_shut(mount_watcher_object *self)
+{
+    int state = __atomic_load_n(&self->state, __ATOMIC_ACQUIRE);
+
+    for (;;)
+    {
+        if (state == WATCH_IDLE &&
+            __atomic_compare_exchange_n(&self->state, &state, WATCH_CLOSED, FALSE,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            watch_close(self);
+            return;
+        }
+        if (state == WATCH_BUSY &&
+            __atomic_compare_exchange_n(&self->state, &state, WATCH_CLOSING, FALSE,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return;
+        /* already closed or closing */
+        if (state >= WATCH_CLOSING)
+            return;
+    }
+}
+
+/* take a new snapshot; NULL with an exception set */
+static PyObject *
+mount_watcher_update(mount_watcher_object *self, int *pempty)
+{
+    statfs_t *pbuf = NULL;
+    PyObject *changes = NULL;
+    mount_diff diff;
+    int mcnt = 0;
+    int ok = FALSE;
+
+    Py_BEGIN_ALLOW_THREADS
+    watch_drain(self);
+    if ((mcnt = watch_snapshot(&pbuf, self->flags)) >= 0)
+        if (!(ok = watch_diff(&diff, self->pbuf, self->mcnt, pbuf, mcnt)))
+            errno = ENOMEM;
+    Py_END_ALLOW_THREADS
+
+    if (!ok)
+    {
+        free(pbuf);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    changes = build_mount_changes(self->st, &diff);
+    *pempty = !(diff.nadded || diff.nremoved || diff.nremounted);
+    watch_diff_free(&diff);
+    if (!changes)
+    {
+        free(pbuf);
+        return NULL;
+    }
+    free(self->pbuf);
+    self->pbuf = pbuf;
+    self->mcnt = mcnt;
+    return changes;
+}
+
+static PyObject *
+mount_watcher_read(mount_watcher_object *self, PyObject *args)
+{
+    PyObject *changes = NULL;
+    int empty = FALSE;
+
+    (void) args;
+
+    if (!mount_watcher_enter_busy(self, "read"))
+        return NULL;
+    changes = mount_watcher_update(self, &empty);
+    mount_watcher_leave(self);
+    return changes;
+}
+
+/* the next non-empty changes */
+static PyObject *
+mount_watcher_wait(mount_watcher_object *self)
+{
+    PyObject *changes = NULL;
+    struct pollfd pfd;
+    int empty = TRUE;
+    int res = 0;
+
+    while (empty)
+    {
+        pfd.fd = self->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        Py_BEGIN_ALLOW_THREADS
+        res = poll(&pfd, 1, 1000);
+        Py_END_ALLOW_THREADS
+
+        if (res < 0 && errno != EINTR)
+            return PyErr_SetFromErrno(PyExc_OSError);
+        if (PyErr_CheckSignals() < 0)
+            return NULL;
+        /* closed meanwhile: the iteration ends */
+        if (mount_watcher_closed(self))
+        {
+            Py_XDECREF(changes);
+            return NULL;
+        }
+        if (res <= 0)
+            continue;
+        Py_XDECREF(changes);
+        if (!(changes = mount_watcher_update(self, &empty)))
+            return NULL;
+    }
+    return changes;
+}
+
+static PyObject *
+mount_watcher_next(mount_watcher_object *self)
+{
+    PyObject *changes = NULL;
+
+    if (!mount_watcher_enter_busy(self, "next"))
+        return NULL;
+    changes = mount_watcher_wait(self);
+    mount_watcher_leave(self);
+    return changes;
+}
+
+static PyObject *
+mount_watcher_close(mount_watcher_object *self, PyObject *args)
+{
+    (void) args;
+
+    mount_watcher_shut(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+mount_watcher_enter(mount_watcher_object *self, PyObject *args)
+{
+    (void) args;
+
+    if (!mount_watcher_check(self))
+        return NULL;
+    Py_IncRef((PyObject *) self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+mount_watcher_exit(mount_watcher_object *self, PyObject *args)
+{
+    (void) args;
+
+    mount_watcher_shut(self);
+    Py_RETURN_FALSE;
+}
+
+static PyObject *
+mount_watcher_get_closed(mount_watcher_object *self, void *closure)
+{
+    (void) closure;
+    return PyBool_FromLong(mount_watcher_closed(self));
+}
+
+static PyMethodDef mount_watcher_methods[] = {
+    {
+        "fileno", (PyCFunction) mount_watcher_fileno, METH_NOARGS,
+        "fileno() -> int\n"
+    },
+    {
+        "read", (PyCFunction) mount_watcher_read, METH_NOARGS,
+        "read() -> mount_changes\n"
+    },
+    {
+        "close", (PyCFunction) mount_watcher_close, METH_NOARGS,
+        "close() -> None\n"
+    },
+    { "__enter__", (PyCFunction) mount_watcher_enter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction) mount_watcher_exit, METH_VARARGS, NULL },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+
+static PyGetSetDef mount_watcher_getset[] = {
+    { "closed", (getter) mount_watcher_get_closed, NULL, NULL, NULL },
+    {NULL, NULL, NULL, NULL, NULL}, /* end */
+};
+
+static PyType_Slot mount_watcher_slots[] = {
+    { Py_tp_doc, (void *) "MountWatcher(flags: int = MNT_NOWAIT)\n" },
+    { Py_tp_new, (void *) mount_watcher_new },
+    { Py_tp_dealloc, (void *) mount_watcher_dealloc },
+    { Py_tp_iter, (void *) PyObject_SelfIter },
+    { Py_tp_iternext, (void *) mount_watcher_next },
+    { Py_tp_methods, (void *) mount_watcher_methods },
+    { Py_tp_getset, (void *) mount_watcher_getset },
+    { 0, NULL },
+};
+
+static PyType_Spec mount_watcher_spec = {
+    .name = "statfs.MountWatcher",
+    .basicsize = sizeof(mount_watcher_object),
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = mount_watcher_slots,
+};
+
+/*
+ * Snapshot: getfsstat() kept as a baseline.  refresh() returns only the
+ * mounts whose counters moved by more than the thresholds since they
+ * were last reported, plus the mounts that appeared or vanished.  The
+ * baseline of an unreported mount is kept, so slow drifts add up; it is
+ * held apart from the table, which mounts() returns as last read.
+ */
+
+typedef struct snapshot_base {
+    uint64_t f_blocks;
+    uint64_t f_bfree;
+    uint64_t f_bavail;
+    uint64_t f_files;
+    uint64_t f_ffree;
+} snapshot_base;
+
+typedef struct snapshot_object {
+    PyObject_HEAD
+    int flags;
+    statfs_t *pbuf;
+    snapshot_base *pbase;   /* parallel to pbuf */
+    int mcnt;
+    int busy;
+    statfs_state *st;   /* of the defining module */
+} snapshot_object;
+
+typedef struct snapshot_diff {
+    const statfs_t **changed;  /* in the new table */
+    const statfs_t **added;    /* in the new table */
+    const statfs_t **removed;  /* in the old table */
+    int nchanged;
+    int nadded;
+    int nremoved;
+} snapshot_diff;
+
+
+static PyStructSequence_Field snapshot_changes_fields[] = {
+    { "changed", "mounts whose counters moved past the thresholds" },
+    { "added", "mounts that appeared" },
+    { "removed", "mounts that vanished" },
+    { NULL, NULL },
+};
+
+static PyStructSequence_Desc snapshot_changes_desc = {
+    .name = "statfs.snapshot_changes",
+    .doc = "Snapshot.refresh() result",
+    .fields = snapshot_changes_fields,
+    .n_in_sequence = 3,
+};
+
+static int
+counter_moved(uint64_t prev, uint64_t cur, uint64_t total,
+              unsigned long long threshold, double relative)
+{
+    uint64_t delta = (cur > prev) ? cur - prev : prev - cur;
+
+    return delta > threshold && (double) delta > relative * (double) total;
+}
+
+static void
+snapshot_base_set(snapshot_base *pbase, const statfs_t *pmnt)
+{
+    pbase->f_blocks = (uint64_t) pmnt->f_blocks;
+    pbase->f_bfree = (uint64_t) pmnt->f_bfree;
+    pbase->f_bavail = (uint64_t) pmnt->f_bavail;
+    pbase->f_files = (uint64_t) pmnt->f_files;
+    pbase->f_ffree = (uint64_t) pmnt->f_ffree;
+}
+
+/* without the GIL; NULL without memory */
+static snapshot_base *
+snapshot_base_new(const statfs_t *pbuf, int mcnt)
+{
+    snapshot_base *pbase = NULL;
+    int i = 0;
+
+    if (!(pbase = (snapshot_base *) malloc(sizeof(snapshot_base) * (mcnt + 1))))
+        return NULL;
+    for (i = 0; i < mcnt; ++i)
+        snapshot_base_set(pbase + i, pbuf + i);
+    return pbase;
+}
+
+/*
+ * Without the GIL; pnbase becomes the baseline of pnew: its own counters
+ * where they are reported, the old baseline elsewhere.  The relative
+ * threshold is taken of the baseline totals.
+ */
+static int
+snapshot_diff_run(snapshot_diff *diff, const statfs_t *pold, const snapshot_base *pobase,
+                  int ocnt, const statfs_t *pnew, snapshot_base *pnbase, int ncnt,
+                  unsigned long long threshold, double relative)
+{
+    const statfs_t **oref = NULL;
+    const statfs_t **nref = NULL;
+    const snapshot_base *po = NULL;
+    snapshot_base *pb = NULL;
+    const statfs_t *pn = NULL;
+    int i = 0;
+    int j = 0;
+    int c = 0;
+
+    memset(diff, 0, sizeof(*diff));
+    oref = mount_sort(pold, ocnt);
+    nref = mount_sort(pnew, ncnt);
+    diff->changed = (const statfs_t **) malloc(sizeof(statfs_t *) * (ncnt + 1));
+    diff->added = (const statfs_t **) malloc(sizeof(statfs_t *) * (ncnt + 1));
+    diff->removed = (const statfs_t **) malloc(sizeof(statfs_t *) * (ocnt + 1));
+    if (!oref || !nref || !diff->changed || !diff->added || !diff->removed)
+    {
+        free(oref);
+        free(nref);
+        return FALSE;
+    }
+
+    while (i < ocnt || j < ncnt)
+    {
+        if (i >= ocnt)
+            c = 1;
+        else if (j >= ncnt)
+            c = -1;
+        else
+            c = mount_compare(oref[i], nref[j]);
+
+        if (c < 0)
+            diff->removed[diff->nremoved++] = oref[i++];
+        else if (c > 0)
+            diff->added[diff->nadded++] = nref[j++];
+        else
+        {
+            po = pobase + (oref[i++] - pold);
+            pn = nref[j++];
+            pb = pnbase + (pn - pnew);
+            if (counter_moved(po->f_blocks, pn->f_blocks, po->f_blocks, threshold, relative) ||
+                counter_moved(po->f_bfree, pn->f_bfree, po->f_blocks, threshold, relative) ||
+                counter_moved(po->f_bavail, pn->f_bavail, po->f_blocks, threshold, relative) ||
+                counter_moved(po->f_files, pn->f_files, po->f_files, threshold, relative) ||
+                counter_moved(po->f_ffree, pn->f_ffree, po->f_files, threshold, relative))
+                diff->changed[diff->nchanged++] = pn;
+            else
+                *pb = *po; /* keep the reported baseline */
+        }
+    }
+
+    free(oref);
+    free(nref);
+    return TRUE;
+}
+
+static void
+snapshot_diff_free(snapshot_diff *diff)
+{
+    free(diff->changed);
+    free(diff->added);
+    free(diff->removed);
+}
+
+static PyObject *
+build_snapshot_changes(statfs_state *st, const snapshot_diff *diff)
+{
+    PyObject *changes = NULL;
+    PyObject *item = NULL;
+
+    if (!(changes = PyStructSequence_New(st->snapshot_changes_type)))
+        return NULL;
+    if (!(item = build_statfs_refs(st, diff->changed, diff->nchanged)))
+        goto error;
+    PyStructSequence_SET_ITEM(changes, 0, item);
+    if (!(item = build_statfs_refs(st, diff->added, diff->nadded)))
+        goto error;
+    PyStructSequence_SET_ITEM(changes, 1, item);
+    if (!(item = build_statfs_refs(st, diff->removed, diff->nremoved)))
+        goto error;
+    PyStructSequence_SET_ITEM(changes, 2, item);
+    return changes;
+
+error:
+    Py_DecRef(changes);
+    return NULL;
+}
+
+static PyObject *
+snapshot_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "flags", NULL };
+
+    snapshot_object *self = NULL;
+    int flags = MNT_NOWAIT;
+    int mcnt = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", keywords, &flags))
+        return NULL;
+    if (!(self = (snapshot_object *) type->tp_alloc(type, 0)))
+        return NULL;
+    self->st = type_state(type);
+    self->flags = flags;
+
+#if HAVE_GETFSSTAT
+    Py_BEGIN_ALLOW_THREADS
+    mcnt = sys_getfsstat(&self->pbuf, flags);
+    Py_END_ALLOW_THREADS
+#else  /* !HAVE_GETFSSTAT */
+    mcnt = -1;
+    errno = ENOSYS;
+#endif /* !HAVE_GETFSSTAT */
+
+    if (mcnt < 0)
+    {
+        PyErr_SetFromErrno(errno == ENOSYS ? PyExc_NotImplementedError : PyExc_OSError);
+        Py_DecRef((PyObject *) self);
+        return NULL;
+    }
+    self->mcnt = mcnt;
+    if (!(self->pbase = snapshot_base_new(self->pbuf, mcnt)))
+    {
+        Py_DecRef((PyObject *) self);
+        return PyErr_NoMemory();
+    }
+    return (PyObject *) self;
+}
+
+static void
+snapshot_dealloc(snapshot_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    free(self->pbuf);
+    free(self->pbase);
+    type->tp_free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+static PyObject *
+snapshot_refresh(snapshot_object *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "threshold", "relative", NULL };
+
+    unsigned long long threshold = 0;
+    double relative = 0.0;
+    PyObject *changes = NULL;
+    statfs_t *pbuf = NULL;
+    statfs_t *swap = NULL;
+    snapshot_base *pbase = NULL;
+    snapshot_base *bswap = NULL;
+    snapshot_diff diff;
+    int mcnt = 0;
+    int ok = FALSE;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Kd", keywords, &threshold, &relative))
+        return NULL;
+    if (relative < 0 || relative != relative)
+    {
+        PyErr_SetString(PyExc_ValueError, "relative must be a non-negative number");
+        return NULL;
+    }
+
+    if (!BusyEnter(&self->busy, "refresh"))
+        return NULL;
+#if HAVE_GETFSSTAT
+    Py_BEGIN_ALLOW_THREADS
+    if ((mcnt = sys_getfsstat(&pbuf, self->flags)) >= 0)
+    {
+        /* the reported mounts keep their own counters */
+        if (!(pbase = snapshot_base_new(pbuf, mcnt)) ||
+            !(ok = snapshot_diff_run(&diff, self->pbuf, self->pbase, self->mcnt,
+                                     pbuf, pbase, mcnt, threshold, relative)))
+            errno = ENOMEM;
+    }
+    Py_END_ALLOW_THREADS
+#else  /* !HAVE_GETFSSTAT */
+    errno = ENOSYS;
+#endif /* !HAVE_GETFSSTAT */
+
+    if (!ok)
+    {
+        BusyLeave(&self->busy);
+        free(pbuf);
+        free(pbase);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    changes = build_snapshot_changes(self->st, &diff);
+    snapshot_diff_free(&diff);
+    if (changes)
+    {
+        /* mounts() may be reading the old table */
+        Py_BEGIN_CRITICAL_SECTION(self);
+        swap = self->pbuf;
+        bswap = self->pbase;
+        self->pbuf = pbuf;
+        self->pbase = pbase;
+        self->mcnt = mcnt;
+        pbuf = swap;
+        pbase = bswap;
+        Py_END_CRITICAL_SECTION();
+    }
+    BusyLeave(&self->busy);
+    free(pbuf);
+    free(pbase);
+    return changes;
+}
+
+static PyObject *
+snapshot_mounts(snapshot_object *self, PyObject *args)
+{
+    PyObject *plist = NULL;
+
+    (void) args;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    plist = build_statfs_list(self->st, self->pbuf, self->mcnt, FALSE, NULL);
+    Py_END_CRITICAL_SECTION();
+    return plist;
+}
+
+static Py_ssize_t
+snapshot_length(snapshot_object *self)
+{
+    return self->mcnt;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-function-type"
+static PyMethodDef snapshot_methods[] = {
+    {
+        "refresh", (PyCFunction) snapshot_refresh, METH_VARARGS | METH_KEYWORDS,
+        "refresh(threshold: int = 0, relative: float = 0.0) -> snapshot_changes\n"
+    },
+    {
+        "mounts", (PyCFunction) snapshot_mounts, METH_NOARGS,
+        "mounts() -> list\n"
+    },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+#pragma GCC diagnostic pop
+
+static PyType_Slot snapshot_slots[] = {
+    { Py_tp_doc, (void *) "Snapshot(flags: int = MNT_NOWAIT)\n" },
+    { Py_tp_new, (void *) snapshot_new },
+    { Py_tp_dealloc, (void *) snapshot_dealloc },
+    { Py_tp_methods, (void *) snapshot_methods },
+    { Py_sq_length, (void *) snapshot_length },
+    { 0, NULL },
+};
+
+static PyType_Spec snapshot_spec = {
+    .name = "statfs.Snapshot",
+    .basicsize = sizeof(snapshot_object),
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = snapshot_slots,
+};
+
+/*
+ * Poller: getfsstat() into a buffer kept across calls.  The result list
+ * is kept too: each mount keeps its live record, found by its identity
+ * rather than its position, and a changed entry is rewritten in place.
+ * The sort and lookup arrays are kept as well, so polling a mount table
+ * whose mounts stay the same allocates nothing.
+ */
+
+#define POLLER_SLACK 8
+
+typedef struct poller_object {
+    PyObject_HEAD
+    int flags;
+    int busy;
+    statfs_t *pbuf;
+    int capacity;
+    int mcnt;
+    unsigned long long resizes;
+    PyObject *records;  /* list of lazy_statfs */
+    lazy_statfs_object **oref;  /* old records by identity */
+    PyObject **nref;    /* new records in table order */
+    char *used;
+    Py_ssize_t scratch; /* length of oref, nref and used */
+    statfs_state *st;   /* of the defining module */
+} poller_object;
+
+
+/* without the GIL; grows the buffer while the table may not have fit */
+static int
+poller_fill(poller_object *self)
+{
+    statfs_t *pnew = NULL;
+    int capacity = 0;
+    int mcnt = 0;
+
+    for (;;)
+    {
+        if (self->capacity == 0)
+        {
+            if ((mcnt = getfsstat(NULL, 0, self->flags)) < 0)
+                return -1;
+            capacity = mcnt + POLLER_SLACK;
+        }
+        else
+        {
+            memset(self->pbuf, 0, sizeof(statfs_t) * self->capacity);
+            mcnt = getfsstat(self->pbuf, (int) (sizeof(statfs_t) * self->capacity), self->flags);
+            if (mcnt < 0)
+                return -1;
+            if (mcnt < self->capacity)
+                return mcnt;
+            /* a full buffer may have dropped mounts */
+            capacity = self->capacity * 2;
+        }
+        if (!(pnew = (statfs_t *) realloc(self->pbuf, sizeof(statfs_t) * capacity)))
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        self->pbuf = pnew;
+        self->capacity = capacity;
+        ++self->resizes;
+    }
+}
+
+/* the same mount across polls: on Linux its mount ID, then mount_compare() */
+static int
+poller_identity(const statfs_t *a, const statfs_t *b)
+{
+#ifdef COMPILE_LINUX
+    if (a->f_mntid != b->f_mntid)
+        return (a->f_mntid > b->f_mntid) - (a->f_mntid < b->f_mntid);
+#endif /* COMPILE_LINUX */
+    return mount_compare(a, b);
+}
+
+static int
+poller_compare_ref(const void *a, const void *b)
+{
+    const lazy_statfs_object *ra = *(const lazy_statfs_object *const *) a;
+    const lazy_statfs_object *rb = *(const lazy_statfs_object *const *) b;
+
+    return poller_identity(&ra->mnt, &rb->mnt);
+}
+
+/* the index of an unused old record of the same mount, or -1 */
+static Py_ssize_t
+poller_match(lazy_statfs_object **oref, const char *used, Py_ssize_t size, const statfs_t *pmnt)
+{
+    Py_ssize_t lo = 0;
+    Py_ssize_t hi = size;
+    Py_ssize_t mid = 0;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (poller_identity(&oref[mid]->mnt, pmnt) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < size && poller_identity(&oref[lo]->mnt, pmnt) == 0; ++lo)
+        if (!used[lo])
+            return lo;
+    return -1;
+}
+
+/* a changed entry: new counters, and the cached members dropped */
+static void
+poller_update(lazy_statfs_object *item, const statfs_t *pmnt)
+{
+    PyObject *cache[STATFS_MEMBERS];
+    int i;
+
+    if (memcmp(&item->mnt, pmnt, sizeof(statfs_t)) == 0)
+        return;
+    Py_BEGIN_CRITICAL_SECTION(item);
+    memcpy(&item->mnt, pmnt, sizeof(statfs_t));
+    memcpy(cache, item->cache, sizeof(cache));
+    memset(item->cache, 0, sizeof(item->cache));
+    Py_END_CRITICAL_SECTION();
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+        Py_XDECREF(cache[i]);
+}
+
+/* grown, never shrunk */
+static int
+poller_reserve(poller_object *self, Py_ssize_t count)
+{
+    lazy_statfs_object **oref = NULL;
+    PyObject **nref = NULL;
+    char *used = NULL;
+
+    if (count <= self->scratch)
+        return TRUE;
+    count += POLLER_SLACK;
+    if ((oref = (lazy_statfs_object **) PyMem_Realloc(self->oref, sizeof(*oref) * count)))
+        self->oref = oref;
+    if ((nref = (PyObject **) PyMem_Realloc(self->nref, sizeof(*nref) * count)))
+        self->nref = nref;
+    if ((used = (char *) PyMem_Realloc(self->used, count)))
+        self->used = used;
+    if (!oref || !nref || !used)
+    {
+        PyErr_NoMemory();
+        return FALSE;
+    }
+    self->scratch = count;
+    return TRUE;
+}
+
+static int
+poller_sync(poller_object *self, int mcnt)
+{
+    lazy_statfs_object *item = NULL;
+    PyObject *records = NULL;
+    Py_ssize_t size = 0;
+    Py_ssize_t osize = 0;
+    Py_ssize_t moved = 0;   /* nref[moved..n) are still owned here */
+    Py_ssize_t n = 0;
+    Py_ssize_t i = 0;
+    Py_ssize_t j = 0;
+    int ok = FALSE;
+
+    if (!self->records && !(self->records = PyList_New(0)))
+        return FALSE;
+    size = PyList_GET_SIZE(self->records);
+    if (!poller_reserve(self, size > mcnt ? size : mcnt))
+        return FALSE;
+    /* only live records: the list is the caller's to modify */
+    for (i = 0; i < size; ++i)
+    {
+        item = (lazy_statfs_object *) PyList_GET_ITEM(self->records, i);
+        if (Py_TYPE(item) == self->st->lazy_statfs_type && item->live)
+            self->oref[osize++] = item;
+    }
+    qsort(self->oref, osize, sizeof(lazy_statfs_object *), poller_compare_ref);
+    memset(self->used, 0, osize);
+
+    for (n = 0; n < mcnt; ++n)
+    {
+        if ((j = poller_match(self->oref, self->used, osize, self->pbuf + n)) >= 0)
+        {
+            self->used[j] = TRUE;
+            poller_update(self->oref[j], self->pbuf + n);
+            Py_IncRef((PyObject *) self->oref[j]);
+            self->nref[n] = (PyObject *) self->oref[j];
+        }
+        else if ((self->nref[n] = build_lazy_statfs(self->st, self->pbuf + n)))
+            ((lazy_statfs_object *) self->nref[n])->live = TRUE;
+        else
+            goto exit;
+    }
+
+    /* the same list object: only differing items are replaced */
+    if (PyList_GET_SIZE(self->records) == mcnt)
+    {
+        for (ok = TRUE; ok && moved < n; ++moved)
+        {
+            if (PyList_GET_ITEM(self->records, moved) == self->nref[moved])
+                Py_DecRef(self->nref[moved]);
+            else
+                ok = (PyList_SetItem(self->records, moved, self->nref[moved]) == 0);
+        }
+    }
+    else if ((records = PyList_New(mcnt)))
+    {
+        for (; moved < n; ++moved)
+            ListMoveItem(records, moved, &self->nref[moved]);
+        ok = (PyList_SetSlice(self->records, 0, PyList_GET_SIZE(self->records), records) == 0);
+        Py_DecRef(records);
+    }
+exit:
+    for (; moved < n; ++moved)
+        Py_DecRef(self->nref[moved]);
+    return ok;
+}
+
+static PyObject *
+poller_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "flags", NULL };
+
+    poller_object *self = NULL;
+    int flags = MNT_NOWAIT;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", keywords, &flags))
+        return NULL;
+    if (!(self = (poller_object *) type->tp_alloc(type, 0)))
+        return NULL;
+    self->st = type_state(type);
+    self->flags = flags;
+    if (!(self->records = PyList_New(0)))
+    {
+        Py_DecRef((PyObject *) self);
+        return NULL;
+    }
+    return (PyObject *) self;
+}
+
+/* the list is returned to the caller, who may put the Poller in it */
+static int
+poller_traverse(poller_object *self, visitproc visit, void *arg)
+{
+    Py_VISIT(Py_TYPE(self));
+    Py_VISIT(self->records);
+    return 0;
+}
+
+static int
+poller_clear(poller_object *self)
+{
+    Py_CLEAR(self->records);
+    return 0;
+}
+
+static void
+poller_dealloc(poller_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+    PyObject_GC_UnTrack(self);
+    poller_clear(self);
+    free(self->pbuf);
+    PyMem_Free(self->oref);
+    PyMem_Free(self->nref);
+    PyMem_Free(self->used);
+    type->tp_free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+static PyObject *
+poller_poll(poller_object *self, PyObject *args)
+{
+    int mcnt = 0;
+    int ok = FALSE;
+
+    (void) args;
+
+#if HAVE_GETFSSTAT
+    if (!BusyEnter(&self->busy, "poll"))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    mcnt = poller_fill(self);
+    Py_END_ALLOW_THREADS
+
+    if (mcnt < 0)
+    {
+        BusyLeave(&self->busy);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    self->mcnt = mcnt;
+    ok = poller_sync(self, mcnt);
+    BusyLeave(&self->busy);
+    if (!ok)
+        return NULL;
+    Py_IncRef(self->records);
+    return self->records;
+#else  /* !HAVE_GETFSSTAT */
+    (void) self;
+    (void) mcnt;
+    (void) ok;
+    PyErr_SetString(PyExc_NotImplementedError, "getfsstat not implemented");
+    return NULL;
+#endif /* !HAVE_GETFSSTAT */
+}
+
+static PyObject *
+poller_get_capacity(poller_object *self, void *closure)
+{
+    (void) closure;
+    return PyLong_FromLong(self->capacity);
+}
+
+static PyObject *
+poller_get_resizes(poller_object *self, void *closure)
+{
+    (void) closure;
+    return PyLong_FromUnsignedLongLong(self->resizes);
+}
+
+static Py_ssize_t
+poller_length(poller_object *self)
+{
+    return self->mcnt;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-function-type"
+static PyMethodDef poller_methods[] = {
+    {
+        "poll", (PyCFunction) poller_poll, METH_NOARGS,
+        "poll() -> list\n"
+    },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+#pragma GCC diagnostic pop
+
+static PyGetSetDef poller_getset[] = {
+    { "capacity", (getter) poller_get_capacity, NULL, NULL, NULL },
+    { "resizes", (getter) poller_get_resizes, NULL, NULL, NULL },
+    {NULL, NULL, NULL, NULL, NULL}, /* end */
+};
+
+static PyType_Slot poller_slots[] = {
+    { Py_tp_doc, (void *) "Poller(flags: int = MNT_NOWAIT)\n" },
+    { Py_tp_new, (void *) poller_new },
+    { Py_tp_dealloc, (void *) poller_dealloc },
+    { Py_tp_traverse, (void *) poller_traverse },
+    { Py_tp_clear, (void *) poller_clear },
+    { Py_tp_methods, (void *) poller_methods },
+    { Py_tp_getset, (void *) poller_getset },
+    { Py_sq_length, (void *) poller_length },
+    { 0, NULL },
+};
+
+static PyType_Spec poller_spec = {
+    .name = "statfs.Poller",
+    .basicsize = sizeof(poller_object),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .slots = poller_slots,
+};
+
+/*
+ * MountIndex: one getmntinfo() table with hashes by f_fsid and by mount
+ * point, and a trie over the components of the mount points for
+ * resolve() and submounts().  Lookups never call the kernel; paths are
+ * resolved lexically, without following symbolic links.
+ */
+
+typedef struct trie_node {
+    const char *name;   /* component, in the table */
+    size_t len;
+    int mount;          /* topmost mount on this path, or -1 */
+    int nchild;
+    int capacity;
+    struct trie_node **child; /* sorted by name */
+} trie_node;
+
+typedef struct mount_index_object {
+    PyObject_HEAD
+    statfs_t *pbuf;
+    int mcnt;
+    int *by_fsid;       /* open addressing, index + 1 */
+    int *by_path;
+    size_t mask;
+    trie_node *root;
+    PyObject **records; /* built on first lookup */
+    statfs_state *st;   /* of the defining module */
+} mount_index_object;
+
+
+static size_t
+index_hash_fsid(const statfs_t *pmnt)
+{
+    uint64_t key = ((uint64_t) (uint32_t) pmnt->f_fsid.val[0] << 32) |
+                   (uint32_t) pmnt->f_fsid.val[1];
+
+    return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static size_t
+index_hash_path(const char *path)
+{
+    const unsigned char *p = (const unsigned char *) path;
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+
+    for (; *p; ++p)
+        hash = (hash ^ *p) * 1099511628211ULL;
+    return (size_t) hash;
+}
+
+static int
+index_same_fsid(const statfs_t *a, const statfs_t *b)
+{
+    return a->f_fsid.val[0] == b->f_fsid.val[0] && a->f_fsid.val[1] == b->f_fsid.val[1];
+}
+
+static int
+index_same_path(const statfs_t *a, const statfs_t *b)
+{
+    return strcmp(a->f_mntonname, b->f_mntonname) == 0;
+}
+
+/* a later entry replaces an equal key: the topmost mount wins */
+static void
+index_hash_insert(int *slots, size_t mask, const statfs_t *pbuf, int index,
+                  size_t hash, int (*same)(const statfs_t *, const statfs_t *))
+{
+    size_t slot = hash & mask;
+
+    while (slots[slot] && !same(pbuf + slots[slot] - 1, pbuf + index))
+        slot = (slot + 1) & mask;
+    slots[slot] = index + 1;
+}
+
+static int
+trie_compare(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+
+    if (c)
+        return c;
+    return (alen > blen) - (alen < blen);
+}
+
+/* the child's slot, or where it would be inserted */
+static int
+trie_search(const trie_node *node, const char *name, size_t len, int *found)
+{
+    int lo = 0;
+    int hi = node->nchild;
+    int mid = 0;
+    int c = 0;
+
+    *found = FALSE;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        c = trie_compare(node->child[mid]->name, node->child[mid]->len, name, len);
+        if (c == 0)
+        {
+            *found = TRUE;
+            return mid;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static trie_node *
+trie_new(const char *name, size_t len)
+{
+    trie_node *node = NULL;
+
+    if ((node = (trie_node *) calloc(1, sizeof(trie_node))))
+    {
+        node->name = name;
+        node->len = len;
+        node->mount = -1;
+    }
+    return node;
+}
+
+static void
+trie_free(trie_node *node)
+{
+    int i;
+
+    if (!node)
+        return;
+    for (i = 0; i < node->nchild; ++i)
+        trie_free(node->child[i]);
+    free(node->child);
+    free(node);
+}
+
+static trie_node *
+trie_child(trie_node *node, const char *name, size_t len)
+{
+    trie_node **pnew = NULL;
+    trie_node *child = NULL;
+    int found = FALSE;
+    int slot = trie_search(node, name, len, &found);
+
+    if (found)
+        return node->child[slot];
+    if (node->nchild == node->capacity)
+    {
+        node->capacity = node->capacity ? node->capacity * 2 : 4;
+        if (!(pnew = (trie_node **) realloc(node->child, sizeof(trie_node *) * node->capacity)))
+            return NULL;
+        node->child = pnew;
+    }
+    if (!(child = trie_new(name, len)))
+        return NULL;
+    memmove(node->child + slot + 1, node->child + slot,
+            sizeof(trie_node *) * (node->nchild - slot));
+    node->child[slot] = child;
+    ++node->nchild;
+    return child;
+}
+
+/* the next component of path, skipping "" and "." */
+static const char *
+path_component(const char *path, size_t *plen)
+{
+    const char *end = NULL;
+
+    for (;;)
+    {
+        while (*path == '/')
+            ++path;
+        if (!*path)
+            return NULL;
+        for (end = path; *end && *end != '/'; ++end)
+            ;
+        *plen = (size_t) (end - path);
+        if (!(*plen == 1 && path[0] == '.'))
+            return path;
+        path = end;
+    }
+}
+
+static int
+trie_insert(trie_node *root, const char *path, int index)
+{
+    trie_node *node = root;
+    size_t len = 0;
+
+    while ((path = path_component(path, &len)))
+    {
+        if (!(node = trie_child(node, path, len)))
+            return FALSE;
+        path += len;
+    }
+    node->mount = index;
+    return TRUE;
+}
+
+/* like os.path.normpath() for absolute paths; out holds strlen(path) + 2 */
+static void
+path_normalize(const char *path, char *out)
+{
+    size_t olen = 0;
+    size_t len = 0;
+
+    while ((path = path_component(path, &len)))
+    {
+        if (len == 2 && path[0] == '.' && path[1] == '.')
+        {
+            while (olen > 0 && out[olen - 1] != '/')
+                --olen;
+            if (olen > 0)
+                --olen;
+        }
+        else
+        {
+            out[olen++] = '/';
+            memcpy(out + olen, path, len);
+            olen += len;
+        }
+        path += len;
+    }
+    if (olen == 0)
+        out[olen++] = '/';
+    out[olen] = '\0';
+}
+
+/*
+ * Walks a normalized path: returns the node of the whole path, or NULL
+ * when it leaves the trie; *pmount is the deepest mount on the way.
+ */
+static trie_node *
+trie_walk(trie_node *root, const char *path, int *pmount)
+{
+    trie_node *node = root;
+    size_t len = 0;
+    int found = FALSE;
+    int slot = 0;
+
+    *pmount = root->mount;
+    while ((path = path_component(path, &len)))
+    {
+        slot = trie_search(node, path, len, &found);
+        if (!found)
+            return NULL;
+        node = node->child[slot];
+        if (node->mount >= 0)
+            *pmount = node->mount;
+        path += len;
+    }
+    return node;
+}
+
+static void
+trie_collect(const trie_node *node, char *marks)
+{
+    int i;
+
+    if (node->mount >= 0)
+        marks[node->mount] = 1;
+    for (i = 0; i < node->nchild; ++i)
+        trie_collect(node->child[i], marks);
+}
+
+/* without the GIL */
+static int
+mount_index_build(mount_index_object *self)
+{
+    size_t size = 4;
+    int i;
+
+    while (size < (size_t) self->mcnt * 2)
+        size *= 2;
+    self->mask = size - 1;
+    if (!(self->by_fsid = (int *) calloc(size, sizeof(int))) ||
+        !(self->by_path = (int *) calloc(size, sizeof(int))) ||
+        !(self->root = trie_new("", 0)))
+        return FALSE;
+    for (i = 0; i < self->mcnt; ++i)
+    {
+        /* no fsid (Linux pseudo filesystems): not one mount's key */
+        if (self->pbuf[i].f_fsid.val[0] || self->pbuf[i].f_fsid.val[1])
+            index_hash_insert(self->by_fsid, self->mask, self->pbuf, i,
+                              index_hash_fsid(self->pbuf + i), index_same_fsid);
+        index_hash_insert(self->by_path, self->mask, self->pbuf, i,
+                          index_hash_path(self->pbuf[i].f_mntonname), index_same_path);
+        if (!trie_insert(self->root, self->pbuf[i].f_mntonname, i))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static PyObject *
+mount_index_record(mount_index_object *self, int index)
+{
+    PyObject *record = NULL;
+
+    if (index < 0)
+        return NewNone();
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (!(record = self->records[index]))
+        record = self->records[index] = build_statfs(self->st, self->pbuf + index);
+    Py_XINCREF(record);
+    Py_END_CRITICAL_SECTION();
+    return record;
+}
+
+static PyObject *
+mount_index_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "flags", NULL };
+
+    mount_index_object *self = NULL;
+    int flags = MNT_NOWAIT;
+    int mcnt = 0;
+    int ok = FALSE;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", keywords, &flags))
+        return NULL;
+    if (!(self = (mount_index_object *) type->tp_alloc(type, 0)))
+        return NULL;
+    self->st = type_state(type);
+
+#if HAVE_GETMNTINFO
+    Py_BEGIN_ALLOW_THREADS
+    if ((mcnt = sys_getmntinfo(&self->pbuf, flags)) >= 0)
+    {
+        self->mcnt = mcnt;
+        if (!(ok = mount_index_build(self)))
+            errno = ENOMEM;
+    }
+    Py_END_ALLOW_THREADS
+#else  /* !HAVE_GETMNTINFO */
+    (void) flags;
+    (void) mcnt;
+    errno = ENOSYS;
+#endif /* !HAVE_GETMNTINFO */
+
+    if (!ok)
+    {
+        PyErr_SetFromErrno(errno == ENOSYS ? PyExc_NotImplementedError : PyExc_OSError);
+        Py_DecRef((PyObject *) self);
+        return NULL;
+    }
+    if (!(self->records = (PyObject **) PyMem_Calloc(self->mcnt + 1, sizeof(PyObject *))))
+    {
+        Py_DecRef((PyObject *) self);
+        return PyErr_NoMemory();
+    }
+    return (PyObject *) self;
+}
+
+static void
+mount_index_dealloc(mount_index_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+    int i;
+
+    if (self->records)
+        for (i = 0; i < self->mcnt; ++i)
+            Py_XDECREF(self->records[i]);
+    PyMem_Free(self->records);
+    trie_free(self->root);
+    free(self->by_fsid);
+    free(self->by_path);
+    free(self->pbuf);
+    type->tp_free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+static PyObject *
+mount_index_by_fsid(mount_index_object *self, PyObject *arg)
+{
+    statfs_t key;
+    long val[2];
+    size_t slot = 0;
+    int index = 0;
+
+    if (!PyArg_ParseTuple(arg, "ll;fsid must be a pair of int", &val[0], &val[1]))
+        return NULL;
+    key.f_fsid.val[0] = (int32_t) val[0];
+    key.f_fsid.val[1] = (int32_t) val[1];
+    for (slot = index_hash_fsid(&key) & self->mask; (index = self->by_fsid[slot]); slot = (slot + 1) & self->mask)
+        if (index_same_fsid(self->pbuf + index - 1, &key))
+            return mount_index_record(self, index - 1);
+    return NewNone();
+}
+
+static PyObject *
+mount_index_by_path(mount_index_object *self, PyObject *arg)
+{
+    const char *path = NULL;
+    size_t slot = 0;
+    int index = 0;
+
+    if (!PyUnicode_Check(arg))
+    {
+        PyErr_BadArgument();
+        return NULL;
+    }
+    if (!(path = PyUnicode_AsUTF8AndSize(arg, NULL)))
+        return NULL;
+    for (slot = index_hash_path(path) & self->mask; (index = self->by_path[slot]); slot = (slot + 1) & self->mask)
+        if (strcmp(self->pbuf[index - 1].f_mntonname, path) == 0)
+            return mount_index_record(self, index - 1);
+    return NewNone();
+}
+
+/* normalized copy of an absolute path, or NULL with an exception */
+static char *
+mount_index_path(PyObject *arg)
+{
+    const char *path = NULL;
+    Py_ssize_t len = 0;
+    char *norm = NULL;
+
+    if (!PyUnicode_Check(arg))
+    {
+        PyErr_BadArgument();
+        return NULL;
+    }
+    if (!(path = PyUnicode_AsUTF8AndSize(arg, &len)))
+        return NULL;
+    if (path[0] != '/')
+    {
+        PyErr_SetString(PyExc_ValueError, "path must be absolute");
+        return NULL;
+    }
+    if (!(norm = (char *) PyMem_Malloc((size_t) len + 2)))
+    {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    path_normalize(path, norm);
+    return norm;
+}
+
+static PyObject *
+mount_index_resolve(mount_index_object *self, PyObject *arg)
+{
+    char *path = NULL;
+    int mount = -1;
+
+    if (!(path = mount_index_path(arg)))
+        return NULL;
+    trie_walk(self->root, path, &mount);
+    PyMem_Free(path);
+    return mount_index_record(self, mount);
+}
+
+static PyObject *
+mount_index_submounts(mount_index_object *self, PyObject *arg)
+{
+    const trie_node *node = NULL;
+    PyObject *plist = NULL;
+    PyObject *pinfo = NULL;
+    char *marks = NULL;
+    char *path = NULL;
+    int mount = -1;
+    int i = 0;
+
+    if (!(path = mount_index_path(arg)))
+        return NULL;
+    node = trie_walk(self->root, path, &mount);
+    PyMem_Free(path);
+    if (!(plist = PyList_New(0)) || !node)
+        return plist;
+    if (!(marks = (char *) PyMem_Calloc(self->mcnt + 1, 1)))
+    {
+        Py_DecRef(plist);
+        return PyErr_NoMemory();
+    }
+    trie_collect(node, marks);
+    for (i = 0; i < self->mcnt; ++i)
+    {
+        if (!marks[i])
+            continue;
+        if (!(pinfo = mount_index_record(self, i)) || PyList_Append(plist, pinfo) < 0)
+        {
+            Py_XDECREF(pinfo);
+            Py_DecRef(plist);
+            plist = NULL;
+            break;
+        }
+        Py_DecRef(pinfo);
+    }
+    PyMem_Free(marks);
+    return plist;
+}
+
+static PyObject *
+mount_index_mounts(mount_index_object *self, PyObject *args)
+{
+    PyObject *plist = NULL;
+    PyObject *pinfo = NULL;
+    int i = 0;
+
+    (void) args;
+
+    if (!(plist = PyList_New(self->mcnt)))
+        return NULL;
+    for (i = 0; i < self->mcnt; ++i)
+    {
+        if (!(pinfo = mount_index_record(self, i)))
+        {
+            Py_DecRef(plist);
+            return NULL;
+        }
+        ListMoveItem(plist, i, &pinfo);
+    }
+    return plist;
+}
+
+static Py_ssize_t
+mount_index_length(mount_index_object *self)
+{
+    return self->mcnt;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-function-type"
+static PyMethodDef mount_index_methods[] = {
+    {
+        "by_fsid", (PyCFunction) mount_index_by_fsid, METH_O,
+        "by_fsid(fsid: tuple) -> statfs\n"
+    },
+    {
+        "by_path", (PyCFunction) mount_index_by_path, METH_O,
+        "by_path(mntonname: str) -> statfs\n"
+    },
+    {
+        "resolve", (PyCFunction) mount_index_resolve, METH_O,
+        "resolve(path: str) -> statfs\n"
+    },
+    {
+        "submounts", (PyCFunction) mount_index_submounts, METH_O,
+        "submounts(path: str) -> list\n"
+    },
+    {
+        "mounts", (PyCFunction) mount_index_mounts, METH_NOARGS,
+        "mounts() -> list\n"
+    },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+#pragma GCC diagnostic pop
+
+static PyType_Slot mount_index_slots[] = {
+    { Py_tp_doc, (void *) "MountIndex(flags: int = MNT_NOWAIT)\n" },
+    { Py_tp_new, (void *) mount_index_new },
+    { Py_tp_dealloc, (void *) mount_index_dealloc },
+    { Py_tp_methods, (void *) mount_index_methods },
+    { Py_sq_length, (void *) mount_index_length },
+    { 0, NULL },
+};
+
+static PyType_Spec mount_index_spec = {
+    .name = "statfs.MountIndex",
+    .basicsize = sizeof(mount_index_object),
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = mount_index_slots,
+};
+
+/*
+ * capacity(): df-style figures for every mount in one pass over the
+ * table, and the k fullest mounts without building the other records.
+ */
+
+#define CAPACITY_BY_BYTES   0
+#define CAPACITY_BY_INODES  1
+
+
+static PyStructSequence_Field capacity_fields[] = {
+    { "f_mntonname", "mount point" },
+    { "bytes_total", "f_blocks * f_bsize" },
+    { "bytes_free", "f_bfree * f_bsize" },
+    { "bytes_avail", "f_bavail * f_bsize" },
+    { "bytes_used", "(f_blocks - f_bfree) * f_bsize" },
+    { "bytes_reserved", "(f_bfree - f_bavail) * f_bsize, for the superuser" },
+    { "used_percent", "used / (used + avail) * 100, as df" },
+    { "inodes_total", "f_files" },
+    { "inodes_free", "f_ffree" },
+    { "inodes_used", "f_files - f_ffree" },
+    { "inodes_used_percent", "inodes_used / inodes_total * 100" },
+    { NULL, NULL },
+};
+
+static PyStructSequence_Desc capacity_desc = {
+    .name = "statfs.capacity_result", /* capacity() is the function */
+    .doc = "capacity() result",
+    .fields = capacity_fields,
+    .n_in_sequence = 11,
+};
+
+static uint64_t
+capacity_sub(uint64_t a, uint64_t b)
+{
+    return (a > b) ? a - b : 0;
+}
+
+static double
+capacity_bytes_percent(const statfs_t *pmnt)
+{
+    uint64_t used = capacity_sub((uint64_t) pmnt->f_blocks, (uint64_t) pmnt->f_bfree);
+    uint64_t avail = (uint64_t) pmnt->f_bavail;
+
+    /* the reserved blocks count as neither used nor available */
+    if (used == 0)
+        return 0.0;
+    return (double) used * 100.0 / ((double) used + (double) avail);
+}
+
+static double
+capacity_inodes_percent(const statfs_t *pmnt)
+{
+    uint64_t total = (uint64_t) pmnt->f_files;
+
+    if (total == 0)
+        return 0.0;
+    return (double) capacity_sub(total, (uint64_t) pmnt->f_ffree) * 100.0 / (double) total;
+}
+
+/* count * size, exact beyond 64 bits */
+static PyObject *
+build_product(uint64_t count, uint64_t size)
+{
+    PyObject *a = NULL;
+    PyObject *b = NULL;
+    PyObject *value = NULL;
+    unsigned long long product = 0;
+
+    if (!__builtin_mul_overflow(count, size, &product))
+        return PyLong_FromUnsignedLongLong(product);
+    if ((a = PyLong_FromUnsignedLongLong(count)) && (b = PyLong_FromUnsignedLongLong(size)))
+        value = PyNumber_Multiply(a, b);
+    Py_XDECREF(a);
+    Py_XDECREF(b);
+    return value;
+}
+
+static PyObject *
+build_capacity(statfs_state *st, const statfs_t *pmnt)
+{
+    PyObject *pinfo = NULL;
+    PyObject *item = NULL;
+    uint64_t bsize = (uint64_t) pmnt->f_bsize;
+    uint64_t blocks = (uint64_t) pmnt->f_blocks;
+    uint64_t bfree = (uint64_t) pmnt->f_bfree;
+    uint64_t bavail = (uint64_t) pmnt->f_bavail;
+    uint64_t files = (uint64_t) pmnt->f_files;
+    uint64_t ffree = (uint64_t) pmnt->f_ffree;
+    int i = 0;
+
+    if (!(pinfo = PyStructSequence_New(st->capacity_type)))
+        return NULL;
+    for (i = 0; i < 11; ++i)
+    {
+        switch (i)
+        {
+        case 0:  item = intern_string(st, pmnt->f_mntonname); break;
+        case 1:  item = build_product(blocks, bsize); break;
+        case 2:  item = build_product(bfree, bsize); break;
+        case 3:  item = build_product(bavail, bsize); break;
+        case 4:  item = build_product(capacity_sub(blocks, bfree), bsize); break;
+        case 5:  item = build_product(capacity_sub(bfree, bavail), bsize); break;
+        case 6:  item = PyFloat_FromDouble(capacity_bytes_percent(pmnt)); break;
+        case 7:  item = PyLong_FromUnsignedLongLong(files); break;
+        case 8:  item = PyLong_FromUnsignedLongLong(ffree); break;
+        case 9:  item = PyLong_FromUnsignedLongLong(capacity_sub(files, ffree)); break;
+        default: item = PyFloat_FromDouble(capacity_inodes_percent(pmnt)); break;
+        }
+        if (!item)
+        {
+            Py_DecRef(pinfo);
+            return NULL;
+        }
+        PyStructSequence_SET_ITEM(pinfo, i, item);
+    }
+    return pinfo;
+}
+
+typedef struct capacity_entry {
+    double key;
+    int index;
+} capacity_entry;
+
+/* fuller first; equal keys in table order */
+static int
+capacity_before(const capacity_entry *a, const capacity_entry *b)
+{
+    return a->key > b->key || (a->key == b->key && a->index < b->index);
+}
+
+static void
+capacity_sift_down(capacity_entry *heap, int count, int i)
+{
+    capacity_entry tmp;
+    int child = 0;
+
+    for (; (child = 2 * i + 1) < count; i = child)
+    {
+        /* min-heap on "fullness": the root is the first one to evict */
+        if (child + 1 < count && capacity_before(heap + child, heap + child + 1))
+            ++child;
+        if (!capacity_before(heap + i, heap + child))
+            break;
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+    }
+}
+
+static int
+capacity_compare(const void *a, const void *b)
+{
+    const capacity_entry *pa = (const capacity_entry *) a;
+    const capacity_entry *pb = (const capacity_entry *) b;
+
+    if (pa->index == pb->index)
+        return 0;
+    return capacity_before(pa, pb) ? -1 : 1;
+}
+
+/* the `top` fullest mounts, fullest first; returns their count */
+static int
+capacity_top(const statfs_t *pbuf, int mcnt, int top, int by, capacity_entry *heap)
+{
+    capacity_entry entry;
+    int count = 0;
+    int i = 0;
+    int j = 0;
+
+    for (i = 0; i < mcnt; ++i)
+    {
+        entry.index = i;
+        entry.key = (by == CAPACITY_BY_INODES) ? capacity_inodes_percent(pbuf + i)
+                                               : capacity_bytes_percent(pbuf + i);
+        if (count < top)
+        {
+            heap[count++] = entry;
+            if (count == top)
+                for (j = count / 2 - 1; j >= 0; --j)
+                    capacity_sift_down(heap, count, j);
+        }
+        else if (capacity_before(&entry, heap))
+        {
+            heap[0] = entry;
+            capacity_sift_down(heap, count, 0);
+        }
+    }
+    qsort(heap, count, sizeof(capacity_entry), capacity_compare);
+    return count;
+}
+
+/*
+ * render(): the table as Prometheus text or NDJSON, written from the
+ * statfs_t records straight into one bytes object.  A first pass only
+ * counts the bytes, the second one fills the allocated object; both run
+ * without the GIL and create no Python object per mount.
+ */
+
+#define RENDER_PROMETHEUS  0
+#define RENDER_NDJSON      1
+
+static const int render_default_fields[] = {
+    STATFS_BSIZE, STATFS_BLOCKS, STATFS_BFREE, STATFS_BAVAIL, STATFS_FILES, STATFS_FFREE,
+};
+
+typedef struct render_spec {
+    int format;
+    const char *prefix;     /* of the metric names */
+    statfs_projection fields;
+    PyObject *items;        /* owns the label strings */
+    Py_ssize_t nlabels;
+    const char **names;
+    const char **values;
+} render_spec;
+
+typedef struct render_writer {
+    char *data;             /* NULL: count only */
+    size_t size;
+} render_writer;
+
+static int
+render_value(const statfs_t *pmnt, int index, uint64_t *pvalue)
+{
+#define render_gen(n) *pvalue = (uint64_t) pmnt->f_##n; return TRUE
+
+    switch (index)
+    {
+    case STATFS_FLAGS:       render_gen(flags);
+#ifndef COMPILE_LINUX
+    case STATFS_OWNER:       render_gen(owner);
+#endif /* !COMPILE_LINUX */
+    case STATFS_TYPE:        render_gen(type);
+
+    case STATFS_IOSIZE:      render_gen(iosize);
+    case STATFS_BSIZE:       render_gen(bsize);
+    case STATFS_BLOCKS:      render_gen(blocks);
+    case STATFS_BAVAIL:      render_gen(bavail);
+    case STATFS_BFREE:       render_gen(bfree);
+
+    case STATFS_FFREE:       render_gen(ffree);
+    case STATFS_FILES:       render_gen(files);
+
+#ifdef COMPILE_FREEBSD
+    case STATFS_NAMEMAX:     render_gen(namemax);
+    case STATFS_SYNCWRITES:  render_gen(syncwrites);
+    case STATFS_ASYNCWRITES: render_gen(asyncwrites);
+    case STATFS_SYNCREADS:   render_gen(syncreads);
+    case STATFS_ASYNCREADS:  render_gen(asyncreads);
+#endif /* COMPILE_FREEBSD */
+#ifdef COMPILE_LINUX
+    case STATFS_NAMEMAX:     render_gen(namemax);
+    case STATFS_FRSIZE:      render_gen(frsize);
+    case STATFS_FAVAIL:      render_gen(favail);
+    case STATFS_MNTID:       render_gen(mntid);
+#endif /* COMPILE_LINUX */
+
+    default:
+        return FALSE;
+    }
+
+#undef render_gen
+}
+
+/* [a-zA-Z_][a-zA-Z0-9_]*, ':' too in metric names */
+static int
+render_name_valid(const char *name, int metric)
+{
+    const char *p = name;
+
+    for (; *p; ++p)
+    {
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_' ||
+            (metric && *p == ':') || (p != name && *p >= '0' && *p <= '9'))
+            continue;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+render_spec_exit(render_spec *spec)
+{
+    PyMem_Free((void *) spec->names);
+    PyMem_Free((void *) spec->values);
+    Py_XDECREF(spec->items);
+    spec->names = NULL;
+    spec->values = NULL;
+    spec->items = NULL;
+}
+
+/* on failure the spec is released */
+static int
+parse_render(render_spec *spec, const char *format, PyObject *labels,
+             PyObject *fields, const char *prefix)
+{
+    statfs_t zero;
+    PyObject *item = NULL;
+    uint64_t value = 0;
+    Py_ssize_t i = 0;
+    int j = 0;
+    int index = 0;
+
+    memset(spec, 0, sizeof(*spec));
+    if (strcmp(format, "prometheus") == 0)
+        spec->format = RENDER_PROMETHEUS;
+    else if (strcmp(format, "ndjson") == 0)
+        spec->format = RENDER_NDJSON;
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "format must be 'prometheus' or 'ndjson'");
+        return FALSE;
+    }
+    if (!render_name_valid(prefix, TRUE) || (prefix[0] >= '0' && prefix[0] <= '9'))
+    {
+        PyErr_Format(PyExc_ValueError, "invalid metric prefix: '%s'", prefix);
+        return FALSE;
+    }
+    spec->prefix = prefix;
+
+    /* fields: numeric members, each once */
+    if (!parse_fields(fields, &spec->fields))
+        return FALSE;
+    if (spec->fields.count == 0)
+    {
+        spec->fields.count = (int) (sizeof(render_default_fields) / sizeof(render_default_fields[0]));
+        memcpy(spec->fields.index, render_default_fields, sizeof(render_default_fields));
+    }
+    memset(&zero, 0, sizeof(zero));
+    for (j = 0; j < spec->fields.count; ++j)
+    {
+        index = spec->fields.index[j];
+        if (!render_value(&zero, index, &value))
+        {
+            PyErr_Format(PyExc_ValueError, "%s is not a number on this system",
+                         statfs_member[index][0]);
+            return FALSE;
+        }
+        for (i = 0; i < j; ++i)
+            if (spec->fields.index[i] == index)
+            {
+                PyErr_Format(PyExc_ValueError, "duplicate member: %s", statfs_member[index][0]);
+                return FALSE;
+            }
+    }
+
+    /* labels: name -> value, the same on every mount */
+    if (!labels || labels == Py_None)
+        return TRUE;
+    if (!PyDict_Check(labels))
+    {
+        PyErr_SetString(PyExc_TypeError, "labels must be a dict of str");
+        return FALSE;
+    }
+    if (!(spec->items = PyDict_Items(labels)))
+        return FALSE;
+    spec->nlabels = PyList_GET_SIZE(spec->items);
+    spec->names = (const char **) PyMem_Malloc(sizeof(const char *) * (spec->nlabels + 1));
+    spec->values = (const char **) PyMem_Malloc(sizeof(const char *) * (spec->nlabels + 1));
+    if (!spec->names || !spec->values)
+    {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i < spec->nlabels; ++i)
+    {
+        item = PyList_GET_ITEM(spec->items, i);
+        if (!PyUnicode_Check(PyTuple_GET_ITEM(item, 0)) || !PyUnicode_Check(PyTuple_GET_ITEM(item, 1)))
+        {
+            PyErr_SetString(PyExc_TypeError, "labels must be a dict of str");
+            goto error;
+        }
+        if (!(spec->names[i] = PyUnicode_AsUTF8AndSize(PyTuple_GET_ITEM(item, 0), NULL)) ||
+            !(spec->values[i] = PyUnicode_AsUTF8AndSize(PyTuple_GET_ITEM(item, 1), NULL)))
+            goto error;
+        /* the mount labels and the member keys of ndjson are taken */
+        for (index = 0; index < STATFS_MEMBERS; ++index)
+            if (strcmp(spec->names[i], statfs_member[index][0]) == 0)
+                break;
+        if (!spec->names[i][0] || !render_name_valid(spec->names[i], FALSE) ||
+            strcmp(spec->names[i], "mountpoint") == 0 || strcmp(spec->names[i], "device") == 0 ||
+            strcmp(spec->names[i], "fstype") == 0 || index < STATFS_MEMBERS)
+        {
+            PyErr_Format(PyExc_ValueError, "invalid label name: %R", PyTuple_GET_ITEM(item, 0));
+            goto error;
+        }
+    }
+    return TRUE;
+
+error:
+    render_spec_exit(spec);
+    return FALSE;
+}
+
+inline static void
+render_bytes(render_writer *w, const char *s, size_t len)
+{
+    if (w->data)
+        memcpy(w->data + w->size, s, len);
+    w->size += len;
+}
+
+inline static void
+render_str(render_writer *w, const char *s)
+{
+    render_bytes(w, s, strlen(s));
+}
+
+static void
+render_uint(render_writer *w, uint64_t value)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+
+    do
+    {
+        *--p = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+    render_bytes(w, p, (size_t) (digits + sizeof(digits) - p));
+}
+
+/* bytes of a well-formed UTF-8 sequence at s (s[0] >= 0x80), 0 if none */
+static int
+render_utf8(const unsigned char *s)
+{
+    int len = 0;
+    int i = 0;
+
+    if (s[0] >= 0xC2 && s[0] <= 0xDF)
+        len = 2;
+    else if (s[0] >= 0xE0 && s[0] <= 0xEF)
+        len = 3;
+    else if (s[0] >= 0xF0 && s[0] <= 0xF4)
+        len = 4;
+    else
+        return 0;
+    /* no overlong forms, surrogates or code points above U+10FFFF */
+    if ((s[0] == 0xE0 && s[1] < 0xA0) || (s[0] == 0xED && s[1] > 0x9F) ||
+        (s[0] == 0xF0 && s[1] < 0x90) || (s[0] == 0xF4 && s[1] > 0x8F))
+        return 0;
+    for (i = 1; i < len; ++i)
+        if ((s[i] & 0xC0) != 0x80)
+            return 0;
+    return len;
+}
+
+/*
+ * A quoted string: '\\', '"' and newline escaped, other controls as
+ * \u00XX in JSON.  Mount names are bytes; invalid UTF-8 becomes U+FFFD.
+ */
+static void
+render_quoted(render_writer *w, const char *s, int json)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *) s;
+    const unsigned char *run = p;
+    char esc[6];
+    int len = 0;
+
+    render_bytes(w, "\"", 1);
+    while (*p)
+    {
+        if (*p >= 0x20 && *p < 0x80 && *p != '\\' && *p != '"')
+        {
+            ++p;
+            continue;
+        }
+        if (*p >= 0x80 && (len = render_utf8(p)))
+        {
+            p += len;
+            continue;
+        }
+        render_bytes(w, (const char *) run, (size_t) (p - run));
+        if (*p == '\\')
+            render_bytes(w, "\\\\", 2);
+        else if (*p == '"')
+            render_bytes(w, "\\\"", 2);
+        else if (*p == '\n')
+            render_bytes(w, "\\n", 2);
+        else if (*p >= 0x80)
+            render_bytes(w, "\xEF\xBF\xBD", 3);
+        else if (json)
+        {
+            memcpy(esc, "\\u00", 4);
+            esc[4] = hex[*p >> 4];
+            esc[5] = hex[*p & 0xF];
+            render_bytes(w, esc, 6);
+        }
+        else
+            render_bytes(w, (const char *) p, 1);
+        run = ++p;
+    }
+    render_bytes(w, (const char *) run, (size_t) (p - run));
+    render_bytes(w, "\"", 1);
+}
+
+typedef struct render_point {
+    const char *name;
+    int index;
+} render_point;
+
+static int
+render_point_compare(const void *a, const void *b)
+{
+    const render_point *pa = (const render_point *) a;
+    const render_point *pb = (const render_point *) b;
+    int res = strcmp(pa->name, pb->name);
+
+    if (res)
+        return res;
+    return (pa->index > pb->index) - (pa->index < pb->index);
+}
+
+/*
+ * Prometheus: one series per mount point.  Stacked mounts share their
+ * labels, and statfs() of a covered one reports the mount on top anyway,
+ * so only the last one listed (the top) is kept.  Compacts the table in
+ * place, returns the new count, or -1 with errno.
+ */
+static int
+render_topmost(statfs_t *pbuf, int mcnt)
+{
+    render_point *points = NULL;
+    char *covered = NULL;
+    int i = 0;
+    int n = 0;
+
+    if (mcnt < 2)
+        return mcnt;
+    points = (render_point *) malloc(sizeof(render_point) * mcnt);
+    covered = (char *) calloc(mcnt, 1);
+    if (!points || !covered)
+    {
+        free(points);
+        free(covered);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < mcnt; ++i)
+    {
+        points[i].name = pbuf[i].f_mntonname;
+        points[i].index = i;
+    }
+    qsort(points, mcnt, sizeof(render_point), render_point_compare);
+    for (i = 0; i + 1 < mcnt; ++i)
+        if (strcmp(points[i].name, points[i + 1].name) == 0)
+            covered[points[i].index] = TRUE;
+    free(points);
+    for (i = 0; i < mcnt; ++i)
+        if (!covered[i])
+        {
+            if (n != i)
+                memcpy(pbuf + n, pbuf + i, sizeof(statfs_t));
+            ++n;
+        }
+    free(covered);
+    return n;
+}
+
+static void
+render_prometheus(render_writer *w, const render_spec *spec, const statfs_t *pbuf, int mcnt)
+{
+    const char *name = NULL;
+    uint64_t value = 0;
+    Py_ssize_t k = 0;
+    int i = 0;
+    int j = 0;
+
+    /* one family after the other, as the exposition format requires */
+    for (j = 0; j < spec->fields.count; ++j)
+    {
+        name = statfs_member[spec->fields.index[j]][0];
+        render_str(w, "# TYPE ");
+        if (spec->prefix[0])
+        {
+            render_str(w, spec->prefix);
+            render_bytes(w, "_", 1);
+        }
+        render_str(w, name);
+        render_str(w, " gauge\n");
+        for (i = 0; i < mcnt; ++i)
+        {
+            if (spec->prefix[0])
+            {
+                render_str(w, spec->prefix);
+                render_bytes(w, "_", 1);
+            }
+            render_str(w, name);
+            render_str(w, "{mountpoint=");
+            render_quoted(w, pbuf[i].f_mntonname, FALSE);
+            render_str(w, ",device=");
+            render_quoted(w, pbuf[i].f_mntfromname, FALSE);
+            render_str(w, ",fstype=");
+            render_quoted(w, pbuf[i].f_fstypename, FALSE);
+            for (k = 0; k < spec->nlabels; ++k)
+            {
+                render_bytes(w, ",", 1);
+                render_str(w, spec->names[k]);
+                render_bytes(w, "=", 1);
+                render_quoted(w, spec->values[k], FALSE);
+            }
+            render_str(w, "} ");
+            render_value(pbuf + i, spec->fields.index[j], &value);
+            render_uint(w, value);
+            render_bytes(w, "\n", 1);
+        }
+    }
+}
+
+static void
+render_ndjson(render_writer *w, const render_spec *spec, const statfs_t *pbuf, int mcnt)
+{
+    uint64_t value = 0;
+    Py_ssize_t k = 0;
+    int i = 0;
+    int j = 0;
+
+    for (i = 0; i < mcnt; ++i)
+    {
+        render_str(w, "{\"mountpoint\":");
+        render_quoted(w, pbuf[i].f_mntonname, TRUE);
+        render_str(w, ",\"device\":");
+        render_quoted(w, pbuf[i].f_mntfromname, TRUE);
+        render_str(w, ",\"fstype\":");
+        render_quoted(w, pbuf[i].f_fstypename, TRUE);
+        for (k = 0; k < spec->nlabels; ++k)
+        {
+            render_str(w, ",\"");
+            render_str(w, spec->names[k]);
+            render_str(w, "\":");
+            render_quoted(w, spec->values[k], TRUE);
+        }
+        for (j = 0; j < spec->fields.count; ++j)
+        {
+            render_str(w, ",\"");
+            render_str(w, statfs_member[spec->fields.index[j]][0]);
+            render_str(w, "\":");
+            render_value(pbuf + i, spec->fields.index[j], &value);
+            render_uint(w, value);
+        }
+        render_str(w, "}\n");
+    }
+}
+
+/* without the GIL; data NULL: returns the size only */
+static size_t
+render_table(const render_spec *spec, const statfs_t *pbuf, int mcnt, char *data)
+{
+    render_writer w;
+
+    w.data = data;
+    w.size = 0;
+    if (spec->format == RENDER_NDJSON)
+        render_ndjson(&w, spec, pbuf, mcnt);
+    else
+        render_prometheus(&w, spec, pbuf, mcnt);
+    return w.size;
+}
+
+/*
+ * Sampler: a native thread calling statfs()/fstatfs() on its sources
+ * every interval, without the GIL.  Samples go into a single-producer,
+ * single-consumer ring; drain() takes them out as a buffer of
+ * sample_record, and a full ring drops new samples.
+ */
+
+#define SAMPLER_CAPACITY      4096
+#define MAX_SAMPLER_CAPACITY  (1 << 24)
+
+typedef struct sampler_object {
+    PyObject_HEAD
+    char **paths;
+    int npaths;
+    int *fds;           /* duplicated, ours */
+    int nfds;
+    double interval;
+    sample_record *ring;
+    uint64_t mask;      /* capacity - 1 */
+    uint64_t head;      /* written by the thread */
+    uint64_t tail;      /* written by drain() */
+    uint64_t dropped;
+    int running;
+    int stop;           /* under lock */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    statfs_state *st;   /* of the defining module */
+} sampler_object;
+
+
+static void
+sampler_push(sampler_object *self, const sample_record *prec)
+{
+    uint64_t head = __atomic_load_n(&self->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail > self->mask)
+    {
+        __atomic_add_fetch(&self->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    self->ring[head & self->mask] = *prec;
+    __atomic_store_n(&self->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+sampler_sample(sampler_object *self)
+{
+    struct statfs sfs;
+    struct timespec now;
+    sample_record rec;
+    int source = 0;
+    int rc = 0;
+
+    for (source = 0; source < self->npaths + self->nfds; ++source)
+    {
+        if (source < self->npaths)
+            rc = statfs(self->paths[source], &sfs);
+        else
+            rc = fstatfs(self->fds[source - self->npaths], &sfs);
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        memset(&rec, 0, sizeof(rec));
+        rec.time = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+        rec.source = (uint32_t) source;
+        if (rc < 0)
+            rec.error = errno;
+        else
+        {
+#ifdef COMPILE_LINUX
+            rec.f_bsize = (uint64_t) (sfs.f_frsize ? sfs.f_frsize : sfs.f_bsize);
+#else  /* !COMPILE_LINUX */
+            rec.f_bsize = (uint64_t) sfs.f_bsize;
+#endif /* !COMPILE_LINUX */
+            rec.f_blocks = (uint64_t) sfs.f_blocks;
+            rec.f_bavail = (uint64_t) sfs.f_bavail;
+            rec.f_bfree = (uint64_t) sfs.f_bfree;
+            rec.f_ffree = (uint64_t) sfs.f_ffree;
+            rec.f_files = (uint64_t) sfs.f_files;
+        }
+        sampler_push(self, &rec);
+    }
+}
+
+static void *
+sampler_main(void *arg)
+{
+    sampler_object *self = (sampler_object *) arg;
+    double next = clock_monotonic();
+    double wait = 0;
+    int stop = FALSE;
+
+    while (!stop)
+    {
+        sampler_sample(self);
+
+        /* on the schedule; ticks missed by a slow round are skipped */
+        next += self->interval;
+        if ((wait = next - clock_monotonic()) < 0)
+        {
+            next += self->interval * (double) (long long) (-wait / self->interval + 1);
+            wait = next - clock_monotonic();
+        }
+
+        pthread_mutex_lock(&self->lock);
+        while (!self->stop && cond_wait_until(&self->cond, &self->lock, next) != ETIMEDOUT)
+            ;
+        stop = self->stop;
+        pthread_mutex_unlock(&self->lock);
+    }
+    return NULL;
+}
+
+static PyObject *
+sampler_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "paths", "fds", "interval", "capacity", NULL };
+
+    sampler_object *self = NULL;
+    PyObject *paths = NULL;
+    PyObject *fds = NULL;
+    PyObject *seq = NULL;
+    PyObject *bytes = NULL;
+    const char *path = NULL;
+    double interval = 0.1;
+    Py_ssize_t capacity = SAMPLER_CAPACITY;
+    Py_ssize_t count = 0;
+    Py_ssize_t i = 0;
+    uint64_t size = 16;
+    long fd = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO$dn", keywords,
+                                     &paths, &fds, &interval, &capacity))
+        return NULL;
+    if (!(interval >= 0.001))
+    {
+        PyErr_SetString(PyExc_ValueError, "interval must be at least 0.001");
+        return NULL;
+    }
+    if (capacity < 1 || capacity > MAX_SAMPLER_CAPACITY)
+    {
+        PyErr_Format(PyExc_ValueError, "capacity must be 1 to %d", MAX_SAMPLER_CAPACITY);
+        return NULL;
+    }
+    while (size < (uint64_t) capacity)
+        size *= 2;
+
+    if (!(self = (sampler_object *) type->tp_alloc(type, 0)))
+        return NULL;
+    self->st = type_state(type);
+    pthread_mutex_init(&self->lock, NULL);
+    cond_init_monotonic(&self->cond);
+    self->interval = interval;
+    self->mask = size - 1;
+    if (!(self->ring = (sample_record *) PyMem_Malloc(sizeof(sample_record) * size)))
+    {
+        PyErr_NoMemory();
+        goto error;
+    }
+
+    if (paths && paths != Py_None)
+    {
+        if (!(seq = PySequence_Fast(paths, "paths must be iterable")))
+            goto error;
+        count = PySequence_Fast_GET_SIZE(seq);
+        if (!(self->paths = (char **) PyMem_Calloc(count + 1, sizeof(char *))))
+        {
+            PyErr_NoMemory();
+            goto error;
+        }
+        for (i = 0; i < count; ++i)
+        {
+            /* copied: the thread never touches the bytes object */
+            if (!(path = parse_path(PySequence_Fast_GET_ITEM(seq, i), &bytes)))
+                goto error;
+            self->paths[i] = strdup(path);
+            Py_CLEAR(bytes);
+            if (!self->paths[i])
+            {
+                PyErr_NoMemory();
+                goto error;
+            }
+            self->npaths = (int) i + 1;
+        }
+        Py_CLEAR(seq);
+    }
+
+    if (fds && fds != Py_None)
+    {
+        if (!(seq = PySequence_Fast(fds, "fds must be iterable")))
+            goto error;
+        count = PySequence_Fast_GET_SIZE(seq);
+        if (!(self->fds = (int *) PyMem_Calloc(count + 1, sizeof(int))))
+        {
+            PyErr_NoMemory();
+            goto error;
+        }
+        for (i = 0; i < count; ++i)
+        {
+            fd = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+            if (fd == -1 && PyErr_Occurred())
+                goto error;
+            if (fd < 0 || fd > INT_MAX)
+            {
+                PyErr_SetString(PyExc_OverflowError, "fd out of range");
+                goto error;
+            }
+            /* the thread may outlive the caller's fd */
+            if ((self->fds[i] = fcntl((int) fd, F_DUPFD_CLOEXEC, 0)) < 0)
+            {
+                PyErr_SetFromErrno(PyExc_OSError);
+                goto error;
+            }
+            self->nfds = (int) i + 1;
+        }
+        Py_CLEAR(seq);
+    }
+    return (PyObject *) self;
+
+error:
+    Py_XDECREF(seq);
+    Py_DecRef((PyObject *) self);
+    return NULL;
+}
+
+static void
+sampler_join(sampler_object *self)
+{
+    if (!self->running)
+        return;
+    pthread_mutex_lock(&self->lock);
+    self->stop = TRUE;
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(self->thread, NULL);
+    Py_END_ALLOW_THREADS
+    self->running = FALSE;
+}
+
+static void
+sampler_dealloc(sampler_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+    int i;
+
+    sampler_join(self);
+    for (i = 0; i < self->npaths; ++i)
+        free(self->paths[i]);
+    for (i = 0; i < self->nfds; ++i)
+        close(self->fds[i]);
+    PyMem_Free(self->paths);
+    PyMem_Free(self->fds);
+    PyMem_Free(self->ring);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->lock);
+    type->tp_free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+static PyObject *
+sampler_start(sampler_object *self, PyObject *args)
+{
+    int err = 0;
+
+    (void) args;
+
+    if (self->running)
+        Py_RETURN_NONE;
+    self->stop = FALSE;
+    if ((err = pthread_create(&self->thread, NULL, sampler_main, self)) != 0)
+    {
+        errno = err;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    self->running = TRUE;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+sampler_stop(sampler_object *self, PyObject *args)
+{
+    (void) args;
+
+    sampler_join(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+sampler_drain(sampler_object *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "max", NULL };
+
+    statfs_buffer_object *buffer = NULL;
+    sample_record *prec = NULL;
+    Py_ssize_t max = -1;
+    uint64_t tail = 0;
+    uint64_t head = 0;
+    uint64_t count = 0;
+    uint64_t first = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n", keywords, &max))
+        return NULL;
+
+    /* the ring has a single consumer: drain() callers take turns */
+    Py_BEGIN_CRITICAL_SECTION(self);
+    tail = __atomic_load_n(&self->tail, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+    count = head - tail;
+    if (max >= 0 && (uint64_t) max < count)
+        count = (uint64_t) max;
+
+    if ((prec = (sample_record *) malloc(sizeof(sample_record) * (count + 1))))
+    {
+        first = self->mask + 1 - (tail & self->mask);
+        if (first > count)
+            first = count;
+        memcpy(prec, self->ring + (tail & self->mask), sizeof(sample_record) * first);
+        memcpy(prec + first, self->ring, sizeof(sample_record) * (count - first));
+        __atomic_store_n(&self->tail, tail + count, __ATOMIC_RELEASE);
+    }
+    Py_END_CRITICAL_SECTION();
+    if (!prec)
+        return PyErr_NoMemory();
+
+    if (!(buffer = new_statfs_buffer(self->st->statfs_buffer_type, NULL, (char *) prec)))
+    {
+        free(prec);
+        return NULL;
+    }
+    buffer->fields = sample_record_fields;
+    buffer->format = sample_record_format;
+    buffer->itemsize = sizeof(sample_record);
+    buffer->shape[0] = (Py_ssize_t) count;
+    buffer->strides[0] = sizeof(sample_record);
+    return (PyObject *) buffer;
+}
+
+static PyObject *
+sampler_enter(sampler_object *self, PyObject *args)
+{
+    PyObject *res = NULL;
+
+    if (!(res = sampler_start(self, args)))
+        return NULL;
+    Py_DecRef(res);
+    Py_IncRef((PyObject *) self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+sampler_exit(sampler_object *self, PyObject *args)
+{
+    (void) args;
+
+    sampler_join(self);
+    Py_RETURN_FALSE;
+}
+
+static PyObject *
+sampler_get_dropped(sampler_object *self, void *closure)
+{
+    (void) closure;
+    return PyLong_FromUnsignedLongLong(__atomic_load_n(&self->dropped, __ATOMIC_RELAXED));
+}
+
+static PyObject *
+sampler_get_pending(sampler_object *self, void *closure)
+{
+    (void) closure;
+    return PyLong_FromUnsignedLongLong(__atomic_load_n(&self->head, __ATOMIC_ACQUIRE) -
+                                       __atomic_load_n(&self->tail, __ATOMIC_RELAXED));
+}
+
+static PyObject *
+sampler_get_capacity(sampler_object *self, void *closure)
+{
+    (void) closure;
+    return PyLong_FromUnsignedLongLong(self->mask + 1);
+}
+
+static PyObject *
+sampler_get_running(sampler_object *self, void *closure)
+{
+    (void) closure;
+    return PyBool_FromLong(self->running);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-function-type"
+static PyMethodDef sampler_methods[] = {
+    {
+        "start", (PyCFunction) sampler_start, METH_NOARGS,
+        "start() -> None\n"
+    },
+    {
+        "stop", (PyCFunction) sampler_stop, METH_NOARGS,
+        "stop() -> None\n"
+    },
+    {
+        "drain", (PyCFunction) sampler_drain, METH_VARARGS | METH_KEYWORDS,
+        "drain(max: int = -1) -> statfs_buffer\n"
+    },
+    { "__enter__", (PyCFunction) sampler_enter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction) sampler_exit, METH_VARARGS, NULL },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+#pragma GCC diagnostic pop
+
+static PyGetSetDef sampler_getset[] = {
+    { "dropped", (getter) sampler_get_dropped, NULL, NULL, NULL },
+    { "pending", (getter) sampler_get_pending, NULL, NULL, NULL },
+    { "capacity", (getter) sampler_get_capacity, NULL, NULL, NULL },
+    { "running", (getter) sampler_get_running, NULL, NULL, NULL },
+    {NULL, NULL, NULL, NULL, NULL}, /* end */
+};
+
+static PyType_Slot sampler_slots[] = {
+    {
+        Py_tp_doc, (void *)
+        "Sampler(paths: iterable = (), fds: iterable = (), *,\n"
+        "        interval: float = 0.1, capacity: int = 4096)\n"
+    },
+    { Py_tp_new, (void *) sampler_new },
+    { Py_tp_dealloc, (void *) sampler_dealloc },
+    { Py_tp_methods, (void *) sampler_methods },
+    { Py_tp_getset, (void *) sampler_getset },
+    { 0, NULL },
+};
+
+static PyType_Spec sampler_spec = {
+    .name = "statfs.Sampler",
+    .basicsize = sizeof(sampler_object),
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = sampler_slots,
+};
+
+/*
+ * iter_mounts(): the table in chunks of `chunk` entries, one record at a
+ * time.  On Linux the mountinfo text is read once when the iterator is
+ * made, so the iteration sees one table; it is parsed and refreshed a
+ * chunk at a time, keeping the statfs_t entries bounded by the chunk.
+ * Elsewhere the kernel hands the table over at once and only the
+ * records are built lazily.
+ */
+
+#define ITER_CHUNK  64
+
+typedef struct mount_iterator_object {
+    PyObject_HEAD
+    int flags;
+    int lazy;
+    statfs_projection proj;
+    statfs_filter filter;
+#ifdef COMPILE_LINUX
+    char *text;         /* the whole mountinfo */
+    char *next;         /* the first line not parsed yet */
+    char *end;
+    double deadline;    /* per mount, as getfsstat() */
+#endif /* COMPILE_LINUX */
+    statfs_t *pbuf;     /* Linux: chunk entries, else the whole table */
+    int chunk;          /* else: entries in the table */
+    int count;
+    int pos;
+    int done;
+    int busy;
+    statfs_state *st;   /* of the defining module */
+} mount_iterator_object;
+
+
+/* without the GIL; the next entries into pbuf, 0 at the end */
+static int
+mount_iterator_fill(mount_iterator_object *self)
+{
+#ifdef COMPILE_LINUX
+    int count = 0;
+    int ok = FALSE;
+
+    while (count < self->chunk && self->next < self->end)
+    {
+        self->next = linux_parse_line(self->next, self->end, self->pbuf + count, linux_scan, &ok);
+        if (ok && filter_match(&self->filter, self->pbuf + count, FALSE))
+            ++count;
+    }
+    linux_refresh_pool(self->pbuf, count, self->flags, self->deadline);
+    return count;
+#else  /* !COMPILE_LINUX */
+    /* the whole table (chunk entries) was fetched at creation */
+    return self->chunk;
+#endif /* !COMPILE_LINUX */
+}
+
+static PyObject *
+mount_iterator_step(mount_iterator_object *self)
+{
+    int count = 0;
+    int err = 0;
+
+    while (self->pos >= self->count)
+    {
+        if (self->done)
+            return NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        if ((count = mount_iterator_fill(self)) < 0)
+            err = errno;
+        Py_END_ALLOW_THREADS
+
+#ifndef COMPILE_LINUX
+        self->done = TRUE;
+#endif /* !COMPILE_LINUX */
+        if (count < 0)
+        {
+            self->done = TRUE;
+            errno = err;
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        if (count == 0)
+        {
+            self->done = TRUE;
+            return NULL;
+        }
+        self->count = filter_apply(&self->filter, self->pbuf, count, TRUE);
+        self->pos = 0;
+    }
+    return build_record(self->st, self->pbuf + self->pos++, self->lazy, &self->proj);
+}
+
+static PyObject *
+mount_iterator_next(mount_iterator_object *self)
+{
+    PyObject *record = NULL;
+
+    if (!BusyEnter(&self->busy, "next"))
+        return NULL;
+    record = mount_iterator_step(self);
+    BusyLeave(&self->busy);
+    return record;
+}
+
+static void
+mount_iterator_dealloc(mount_iterator_object *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
+#ifdef COMPILE_LINUX
+    free(self->text);
+#endif /* COMPILE_LINUX */
+    free(self->pbuf);
+    filter_exit(&self->filter);
+    type->tp_free(self);
+    Py_DecRef((PyObject *) type);
+}
+
+static PyType_Slot mount_iterator_slots[] = {
+    { Py_tp_dealloc, (void *) mount_iterator_dealloc },
+    { Py_tp_iter, (void *) PyObject_SelfIter },
+    { Py_tp_iternext, (void *) mount_iterator_next },
+    { 0, NULL },
+};
+
+static PyType_Spec mount_iterator_spec = {
+    .name = "statfs.mount_iterator",
+    .basicsize = sizeof(mount_iterator_object),
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = mount_iterator_slots,
+};
+
+/*
+ * Arguments of the METH_FASTCALL | METH_KEYWORDS methods.
+ *
+ * parse_fastcall() takes the units O, i, p and K with | and $ as
+ * PyArg_ParseTupleAndKeywords() does, then ":name".  The arguments stay
+ * in the vector the interpreter passed; no tuple or dict is made.
+ * A format of more than FASTCALL_MAX units raises SystemError.
+ */
+
+#define FASTCALL_MAX  16
+
+static int
+parse_fastcall(PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+               const char *format, char **keywords, ...)
+{
+    PyObject *values[FASTCALL_MAX];
+    const char *fname = strchr(format, ':');
+    const char *f = NULL;
+    Py_ssize_t nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+    Py_ssize_t i = 0;
+    PyObject *name = NULL;
+    PyObject *index = NULL;
+    va_list va;
+    long lvalue = 0;
+    int npos = -1;
+    int nreq = -1;
+    int cnt = 0;
+    int k = 0;
+
+    fname = fname ? fname + 1 : "function";
+    for (f = format; *f && *f != ':'; ++f)
+    {
+        if (*f == '|')
+            nreq = cnt;
+        else if (*f == '$')
+            npos = cnt;
+        else if (cnt == FASTCALL_MAX || !strchr("OipK", *f))
+        {
+            /* a bug in the format, not in the call: never silently misparse */
+            PyErr_Format(PyExc_SystemError, "%s(): bad parse_fastcall() format (%d units at most)",
+                         fname, FASTCALL_MAX);
+            return FALSE;
+        }
+        else
+            values[cnt++] = NULL;
+    }
+    if (nreq < 0) nreq = cnt;
+    if (npos < 0) npos = cnt;
+
+    if (nargs > npos)
+    {
+        PyErr_Format(PyExc_TypeError, "%s() takes at most %d positional argument%s (%zd given)",
+                     fname, npos, npos == 1 ? "" : "s", nargs);
+        return FALSE;
+    }
+    for (i = 0; i < nargs; ++i)
+        values[i] = args[i];
+    for (i = 0; i < nkw; ++i)
+    {
+        name = PyTuple_GET_ITEM(kwnames, i);
+        for (k = 0; k < cnt; ++k)
+            if (PyUnicode_CompareWithASCIIString(name, keywords[k]) == 0)
+                break;
+        if (k == cnt)
+        {
+            PyErr_Format(PyExc_TypeError, "'%U' is an invalid keyword argument for %s()",
+                         name, fname);
+            return FALSE;
+        }
+        if (values[k])
+        {
+            PyErr_Format(PyExc_TypeError, "argument for %s() given by name ('%s') and position (%d)",
+                         fname, keywords[k], k + 1);
+            return FALSE;
+        }
+        values[k] = args[nargs + i];
+    }
+    for (k = 0; k < nreq; ++k)
+    {
+        if (!values[k])
+        {
+            PyErr_Format(PyExc_TypeError, "%s() missing required argument '%s' (pos %d)",
+                         fname, keywords[k], k + 1);
+            return FALSE;
+        }
+    }
+
+    va_start(va, keywords);
+    for (f = format, k = 0; *f && *f != ':'; ++f)
+    {
+        switch (*f)
+        {
+        case 'O':
+            if (values[k])
+                *va_arg(va, PyObject **) = values[k];
+            else
+                (void) va_arg(va, PyObject **);
+            break;
+        case 'i':
+            if (!values[k])
+            {
+                (void) va_arg(va, int *);
+                break;
+            }
+            if (!(index = PyNumber_Index(values[k])))
+                goto error;
+            lvalue = PyLong_AsLong(index);
+            Py_DecRef(index);
+            if (lvalue == -1 && PyErr_Occurred())
+                goto error;
+            if (lvalue < INT_MIN || lvalue > INT_MAX)
+            {
+                PyErr_Format(PyExc_OverflowError, "%s() argument '%s' out of range",
+                             fname, keywords[k]);
+                goto error;
+            }
+            *va_arg(va, int *) = (int) lvalue;
+            break;
+        case 'p':
+            if (!values[k])
+            {
+                (void) va_arg(va, int *);
+                break;
+            }
+            if ((lvalue = PyObject_IsTrue(values[k])) < 0)
+                goto error;
+            *va_arg(va, int *) = (int) lvalue;
+            break;
+        case 'K':
+            if (!values[k])
+            {
+                (void) va_arg(va, unsigned long long *);
+                break;
+            }
+            if (!PyLong_Check(values[k]))
+            {
+                PyErr_Format(PyExc_TypeError, "%s() argument '%s' must be int, not %.50s",
+                             fname, keywords[k], Py_TYPE(values[k])->tp_name);
+                goto error;
+            }
+            *va_arg(va, unsigned long long *) = PyLong_AsUnsignedLongLongMask(values[k]);
+            break;
+        default:
+            continue; /* | $ */
+        }
+        ++k;
+    }
+    va_end(va);
+    return TRUE;
+
+error:
+    va_end(va);
+    return FALSE;
+}
+
+/*
+ *
+ */
+
+static PyObject *
+method_statfs(PyObject *module, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+#if HAVE_STATFS
+
+    static char *keywords[] = { "path", "timeout", "lazy", "fields", "dir_fd", NULL };
+
+    statfs_state *st = module_state(module);
+    statfs_projection proj;
+    statfs_job *job = NULL;
+    PyObject *name = NULL;
+    PyObject *bytes = NULL;
+    PyObject *otimeout = NULL;
+    PyObject *ofields = NULL;
+    PyObject *odirfd = NULL;
+    PyObject *pinfo = NULL;
+    const char *path = NULL;
+    double timeout = -1.0;
+    int lazy = FALSE;
+    int dirfd = AT_FDCWD;
+
+    if (!parse_fastcall(args, nargs, kwnames, "O|$OpOO:statfs", keywords,
+                        &name, &otimeout, &lazy, &ofields, &odirfd))
+        return NULL;
+    if (!parse_timeout(otimeout, &timeout) || !parse_fields(ofields, &proj))
+        return NULL;
+    if (odirfd && odirfd != Py_None && (dirfd = PyObject_AsFileDescriptor(odirfd)) < 0)
+        return NULL;
+    if (!(path = parse_path(name, &bytes)))
+        return NULL;
+    if (!(job = job_new(dirfd == AT_FDCWD ? JOB_STATFS : JOB_STATFSAT)))
+        goto exit;
+    if (!(job->path = strdup(path)))
+    {
+        job_free(job);
+        PyErr_NoMemory();
+        goto exit;
+    }
+    if (dirfd == AT_FDCWD || timeout < 0)
+        job->fd = dirfd;
+    else if ((job->fd = dup(dirfd)) >= 0)
+        job->owns_fd = TRUE; /* the helper may outlive the caller's fd */
+    else
+    {
+        job_free(job);
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto exit;
+    }
+    if (!job_run(job, timeout))
+        goto exit;
+    pinfo = build_record(st, &job->buf, lazy, &proj);
+    job_free(job);
+exit:
+    Py_DecRef(bytes);
+    return pinfo;
+
+#else  /* !HAVE_STATFS */
+
+    (void) module;
+    (void) args;
+    (void) nargs;
+    (void) kwnames;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_STATFS */
+}
+
+static PyObject *
+method_fstatfs(PyObject *module, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+#if HAVE_STATFS
+
+    static char *keywords[] = { "fd", "timeout", "lazy", "fields", NULL };
+
+    statfs_state *st = module_state(module);
+    statfs_projection proj;
+    statfs_job *job = NULL;
+    PyObject *otimeout = NULL;
+    PyObject *ofields = NULL;
+    PyObject *pinfo = NULL;
+    double timeout = -1.0;
+    int lazy = FALSE;
+    int fd = -1;
+
+    if (!parse_fastcall(args, nargs, kwnames, "i|$OpO:fstatfs", keywords,
+                        &fd, &otimeout, &lazy, &ofields))
+        return NULL;
+    if (!parse_timeout(otimeout, &timeout) || !parse_fields(ofields, &proj))
+        return NULL;
+    if (!(job = job_new(JOB_FSTATFS)))
+        return NULL;
+    if (timeout < 0)
+        job->fd = fd;
+    else if ((job->fd = dup(fd)) >= 0)
+        job->owns_fd = TRUE; /* the helper may outlive the caller's fd */
+    else
+    {
+        job_free(job);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    if (!job_run(job, timeout))
+        return NULL;
+    pinfo = build_record(st, &job->buf, lazy, &proj);
+    job_free(job);
+    return pinfo;
+
+#else  /* !HAVE_FSTATFS */
+
+    (void) module;
+    (void) args;
+    (void) nargs;
+    (void) kwnames;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_FSTATFS */
+}
+
+static PyObject *
+method_getfsstat(PyObject *module, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+#if HAVE_GETFSSTAT
+    static char *keywords[] = {
+        "flags", "timeout", "lazy", "as_buffer", "fields",
+        "include_types", "exclude_types", "require_flags", "exclude_flags", "path_prefix",
+        "deadline", NULL
+    };
+
+    statfs_state *st = module_state(module);
+    statfs_projection proj;
+    statfs_filter filter;
+    statfs_job *job = NULL;
+    PyObject *otimeout = NULL;
+    PyObject *odeadline = NULL;
+    PyObject *ofields = NULL;
+    PyObject *include = NULL;
+    PyObject *exclude = NULL;
+    PyObject *prefix = NULL;
+    unsigned long long require_flags = 0;
+    unsigned long long exclude_flags = 0;
+    PyObject *plist = NULL;
+    double timeout = -1.0;
+    double deadline = -1.0;
+    int flags = MNT_NOWAIT;
+    int lazy = FALSE;
+    int as_buffer = FALSE;
+
+    if (!parse_fastcall(args, nargs, kwnames, "|i$OppOOOKKOO:getfsstat", keywords,
+                        &flags, &otimeout, &lazy, &as_buffer, &ofields,
+                        &include, &exclude, &require_flags, &exclude_flags, &prefix,
+                        &odeadline))
+        return NULL;
+    /* deadline=None: wait for every mount */
+    if (!parse_timeout(otimeout, &timeout) || !parse_fields(ofields, &proj) ||
+        !parse_deadline(odeadline, &deadline))
+        return NULL;
+    if (!parse_filter(&filter, include, exclude, require_flags, exclude_flags, prefix))
+        return NULL;
+    if (!(job = job_new(JOB_GETFSSTAT)))
+        goto exit;
+    if (!job_filter(job, &filter))
+    {
+        job_free(job);
+        goto exit;
+    }
+    job->flags = flags;
+#ifdef COMPILE_LINUX
+    if (odeadline)
+        job->deadline = deadline;
+#endif /* COMPILE_LINUX */
+    if (!job_run(job, timeout))
+        goto exit;
+    job->result = filter_apply(&filter, job->pbuf, job->result, TRUE);
+    if (as_buffer)
+        plist = build_statfs_buffer(st, job->pbuf, job->result);
+    else
+        plist = build_statfs_list(st, job->pbuf, job->result, lazy, &proj);
+    job_free(job);
+exit:
+    filter_exit(&filter);
+    return plist;
+
+#else  /* !HAVE_GETFSSTAT */
+
+    (void) module;
+    (void) args;
+    (void) nargs;
+    (void) kwnames;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_GETFSSTAT */
+}
+
+/* getmntinfo(pid=, root=, source=): the table and the root of the job */
+static int
+job_namespace(statfs_job *job, int pid, PyObject *oroot, PyObject *osource)
+{
+#ifdef COMPILE_LINUX
+
+    PyObject *broot = NULL;
+    PyObject *bsource = NULL;
+    const char *root = NULL;
+    const char *source = NULL;
+    char path[64];
+    int ok = FALSE;
+
+    if (oroot == Py_None)
+        oroot = NULL;
+    if (osource == Py_None)
+        osource = NULL;
+    if (pid >= 0 && osource)
+    {
+        PyErr_SetString(PyExc_ValueError, "pid and source are exclusive");
+        return FALSE;
+    }
+    if (oroot && !(root = parse_path_arg("root", oroot, &broot)))
+        goto exit;
+    if (osource && !(source = parse_path_arg("source", osource, &bsource)))
+        goto exit;
+
+    if (source)
+        job->path = strdup(source);
+    else if (pid >= 0)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/mountinfo", pid);
+        job->path = strdup(path);
+    }
+    if (root)
+        job->root = strdup(root);
+    else if (pid >= 0)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/root", pid);
+        job->root = strdup(path);
+    }
+    if (((source || pid >= 0) && !job->path) || ((root || pid >= 0) && !job->root))
+    {
+        PyErr_NoMemory();
+        goto exit;
+    }
+    ok = TRUE;
+exit:
+    Py_XDECREF(broot);
+    Py_XDECREF(bsource);
+    return ok;
+
+#else  /* !COMPILE_LINUX */
+
+    (void) job;
+    (void) pid;
+    (void) oroot;
+    (void) osource;
+
+    PyErr_SetString(PyExc_NotImplementedError, "pid, root and source need /proc");
+    return FALSE;
+
+#endif /* !COMPILE_LINUX */
+}
+
+static PyObject *
+method_getmntinfo(PyObject *module, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+#if HAVE_GETMNTINFO
+
+    static char *keywords[] = {
+        "flags", "timeout", "lazy", "as_buffer", "cached", "fields",
+        "include_types", "exclude_types", "require_flags", "exclude_flags", "path_prefix",
+        "pid", "root", "source",
+        NULL
+    };
+
+    statfs_state *st = module_state(module);
+    statfs_projection proj;
+    statfs_filter filter;
+    statfs_job *job = NULL;
+    PyObject *otimeout = NULL;
+    PyObject *ofields = NULL;
+    PyObject *include = NULL;
+    PyObject *exclude = NULL;
+    PyObject *prefix = NULL;
+    PyObject *opid = NULL;
+    PyObject *oroot = NULL;
+    PyObject *osource = NULL;
+    unsigned long long require_flags = 0;
+    unsigned long long exclude_flags = 0;
+    PyObject *plist = NULL;
+    PyObject *shared = NULL;
+    PyObject *swap = NULL;
+    double timeout = -1.0;
+    int flags = MNT_NOWAIT;
+    int lazy = FALSE;
+    int as_buffer = FALSE;
+    int cached = FALSE;
+    int share = FALSE;
+    int other = FALSE;
+    long pid = -1;
+
+    if (!parse_fastcall(args, nargs, kwnames, "|i$OpppOOOKKOOOO:getmntinfo", keywords,
+                        &flags, &otimeout, &lazy, &as_buffer, &cached, &ofields,
+                        &include, &exclude, &require_flags, &exclude_flags, &prefix,
+                        &opid, &oroot, &osource))
+        return NULL;
+    if (opid && opid != Py_None)
+    {
+        if ((pid = PyLong_AsLong(opid)) == -1 && PyErr_Occurred())
+            return NULL;
+        if (pid < 0 || pid > INT_MAX)
+        {
+            PyErr_SetString(PyExc_ValueError, "pid out of range");
+            return NULL;
+        }
+    }
+    if (!parse_timeout(otimeout, &timeout) || !parse_fields(ofields, &proj))
+        return NULL;
+    if (!parse_filter(&filter, include, exclude, require_flags, exclude_flags, prefix))
+        return NULL;
+    /* another namespace or table: never cached */
+    other = (pid >= 0 || (oroot && oroot != Py_None) || (osource && osource != Py_None));
+    /* the shared list holds the whole table as whole records */
+    share = cached && !other && !lazy && !proj.count && !filter.active;
+    if (!(job = job_new(other ? JOB_MNTSOURCE : cached ? JOB_MNTCACHE : JOB_GETMNTINFO)))
+        goto exit;
+    if ((other && !job_namespace(job, (int) pid, oroot, osource)) || !job_filter(job, &filter))
+    {
+        job_free(job);
+        goto exit;
+    }
+    job->flags = flags;
+    if (!job_run(job, timeout))
+        goto exit;
+    job->result = filter_apply(&filter, job->pbuf, job->result, TRUE);
+    if (share)
+    {
+        /* only the pointer swap is locked; lists are copied outside */
+        pthread_mutex_lock(&st->list_lock);
+        if (st->cache_list && st->cache_list_serial == job->serial)
+        {
+            shared = st->cache_list;
+            Py_INCREF(shared);
+        }
+        pthread_mutex_unlock(&st->list_lock);
+    }
+    if (as_buffer)
+        plist = build_statfs_buffer(st, job->pbuf, job->result);
+    else if (shared)
+        plist = PyList_GetSlice(shared, 0, PY_SSIZE_T_MAX);
+    else if ((plist = build_statfs_list(st, job->pbuf, job->result, lazy, &proj)) && share &&
+             (shared = PyList_GetSlice(plist, 0, PY_SSIZE_T_MAX)))
+    {
+        pthread_mutex_lock(&st->list_lock);
+        swap = st->cache_list;
+        st->cache_list = shared;
+        st->cache_list_serial = job->serial;
+        pthread_mutex_unlock(&st->list_lock);
+        shared = swap;
+    }
+    Py_XDECREF(shared);
+    job_free(job);
+exit:
+    filter_exit(&filter);
+    return plist;
+
+#else /* !HAVE_GETMNTINFO */
+
+    (void) module;
+    (void) args;
+    (void) nargs;
+    (void) kwnames;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_GETMNTINFO */
+}
+
+static PyObject *
+method_statfs_many(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+#if HAVE_STATFS
+
+    static char *keywords[] = { "paths", "workers", "lazy", "fields", NULL };
+
+    statfs_state *st = module_state(module);
+    statfs_projection proj;
+    statfs_batch batch;
+    PyObject *ofields = NULL;
+    PyObject *paths = NULL;
+    PyObject *plist = NULL;
+    PyObject *bytes = NULL;
+    PyObject *names = NULL;
+    PyObject *seq = NULL;
+    Py_ssize_t count = 0;
+    Py_ssize_t i = 0;
+    int workers = BATCH_WORKERS;
+    int lazy = FALSE;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$ipO", keywords,
+                                     &paths, &workers, &lazy, &ofields))
+        return NULL;
+    if ((workers = parse_workers(workers)) < 0 || !parse_fields(ofields, &proj))
+        return NULL;
+    if (!(seq = PySequence_Fast(paths, "paths must be iterable")))
+        return NULL;
+    count = PySequence_Fast_GET_SIZE(seq);
+    if (!batch_init(&batch, count, FALSE))
+        goto exit;
+    /* the converted paths, as statfs() takes them */
+    if (!(names = PyTuple_New(count)))
+        goto exit;
+    for (i = 0; i < count; ++i)
+    {
+        if (!(batch.paths[i] = parse_path(PySequence_Fast_GET_ITEM(seq, i), &bytes)))
+            goto exit;
+        TupleMoveItem(names, i, &bytes);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    batch_run(&batch, workers);
+    Py_END_ALLOW_THREADS
+
+    plist = build_batch(st, &batch, seq, lazy, &proj);
+exit:
+    batch_exit(&batch);
+    Py_XDECREF(names);
+    Py_DecRef(seq);
+    return plist;
+
+#else  /* !HAVE_STATFS */
+
+    (void) module;
+    (void) args;
+    (void) kwargs;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_STATFS */
+}
+
+static PyObject *
+method_fstatfs_many(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+#if HAVE_STATFS
+
+    static char *keywords[] = { "fds", "workers", "lazy", "fields", NULL };
+
+    statfs_state *st = module_state(module);
+    statfs_projection proj;
+    statfs_batch batch;
+    PyObject *ofields = NULL;
+    PyObject *fds = NULL;
+    PyObject *plist = NULL;
+    PyObject *seq = NULL;
+    Py_ssize_t count = 0;
+    Py_ssize_t i = 0;
+    int workers = BATCH_WORKERS;
+    int lazy = FALSE;
+    long fd = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$ipO", keywords,
+                                     &fds, &workers, &lazy, &ofields))
+        return NULL;
+    if ((workers = parse_workers(workers)) < 0 || !parse_fields(ofields, &proj))
+        return NULL;
+    if (!(seq = PySequence_Fast(fds, "fds must be iterable")))
+        return NULL;
+    count = PySequence_Fast_GET_SIZE(seq);
+    if (!batch_init(&batch, count, TRUE))
+        goto exit;
+    for (i = 0; i < count; ++i)
+    {
+        fd = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (fd == -1 && PyErr_Occurred())
+            goto exit;
+        if (fd < INT_MIN || fd > INT_MAX)
+        {
+            PyErr_SetString(PyExc_OverflowError, "fd out of range");
+            goto exit;
+        }
+        batch.fds[i] = (int) fd;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    batch_run(&batch, workers);
+    Py_END_ALLOW_THREADS
+
+    plist = build_batch(st, &batch, seq, lazy, &proj);
+exit:
+    batch_exit(&batch);
+    Py_DecRef(seq);
+    return plist;
+
+#else  /* !HAVE_FSTATFS */
+
+    (void) module;
+    (void) args;
+    (void) kwargs;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_FSTATFS */
+}
+
+static PyObject *
+method_capacity(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+#if HAVE_GETFSSTAT
+
+    static char *keywords[] = {
+        "flags", "timeout", "top", "by",
+        "include_types", "exclude_types", "require_flags", "exclude_flags", "path_prefix",
+        NULL
+    };
+
+    statfs_state *st = module_state(module);
+    statfs_filter filter;
+    statfs_job *job = NULL;
+    capacity_entry *heap = NULL;
+    PyObject *otimeout = NULL;
+    PyObject *include = NULL;
+    PyObject *exclude = NULL;
+    PyObject *prefix = NULL;
+    PyObject *plist = NULL;
+    PyObject *pinfo = NULL;
+    const char *by = "bytes";
+    unsigned long long require_flags = 0;
+    unsigned long long exclude_flags = 0;
+    double timeout = -1.0;
+    int flags = MNT_NOWAIT;
+    int top = 0;
+    int kind = CAPACITY_BY_BYTES;
+    int count = 0;
+    int i = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i$OisOOKKO", keywords,
+                                     &flags, &otimeout, &top, &by,
+                                     &include, &exclude, &require_flags, &exclude_flags, &prefix))
+        return NULL;
+    if (strcmp(by, "bytes") == 0)
+        kind = CAPACITY_BY_BYTES;
+    else if (strcmp(by, "inodes") == 0)
+        kind = CAPACITY_BY_INODES;
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "by must be 'bytes' or 'inodes'");
+        return NULL;
+    }
+    if (top < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "top must not be negative");
+        return NULL;
+    }
+    if (!parse_timeout(otimeout, &timeout))
+        return NULL;
+    if (!parse_filter(&filter, include, exclude, require_flags, exclude_flags, prefix))
+        return NULL;
+    if (!(job = job_new(JOB_GETFSSTAT)))
+        goto exit;
+    if (!job_filter(job, &filter))
+        goto exit;
+    job->flags = flags;
+    if (!job_run(job, timeout))
+    {
+        job = NULL; /* freed by job_run() */
+        goto exit;
+    }
+    job->result = filter_apply(&filter, job->pbuf, job->result, TRUE);
+
+    if (top == 0)
+    {
+        if (!(plist = PyList_New(job->result)))
+            goto exit;
+        for (i = 0; i < job->result; ++i)
+        {
+            if (!(pinfo = build_capacity(st, job->pbuf + i)))
+                goto error;
+            ListMoveItem(plist, i, &pinfo);
+        }
+        goto exit;
+    }
+
+    if (!(heap = (capacity_entry *) PyMem_Malloc(sizeof(capacity_entry) * top)))
+    {
+        PyErr_NoMemory();
+        goto exit;
+    }
+    count = capacity_top(job->pbuf, job->result, top, kind, heap);
+    if (!(plist = PyList_New(count)))
+        goto exit;
+    for (i = 0; i < count; ++i)
+    {
+        if (!(pinfo = build_capacity(st, job->pbuf + heap[i].index)))
+            goto error;
+        ListMoveItem(plist, i, &pinfo);
+    }
+    goto exit;
+
+error:
+    Py_CLEAR(plist);
+exit:
+    PyMem_Free(heap);
+    if (job)
+        job_free(job);
+    filter_exit(&filter);
+    return plist;
+
+#else  /* !HAVE_GETFSSTAT */
+
+    (void) module;
+    (void) args;
+    (void) kwargs;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_GETFSSTAT */
+}
+
+static PyObject *
+method_render(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+#if HAVE_GETFSSTAT
+
+    static char *keywords[] = {
+        "format", "flags", "timeout", "labels", "fields", "namespace", "into",
+        "include_types", "exclude_types", "require_flags", "exclude_flags", "path_prefix",
+        NULL
+    };
+
+    statfs_filter filter;
+    render_spec spec;
+    Py_buffer view;
+    statfs_job *job = NULL;
+    PyObject *otimeout = NULL;
+    PyObject *labels = NULL;
+    PyObject *fields = NULL;
+    PyObject *into = NULL;
+    PyObject *include = NULL;
+    PyObject *exclude = NULL;
+    PyObject *prefix = NULL;
+    PyObject *result = NULL;
+    const char *format = "prometheus";
+    const char *ns = "statfs";
+    char *data = NULL;
+    unsigned long long require_flags = 0;
+    unsigned long long exclude_flags = 0;
+    double timeout = -1.0;
+    Py_ssize_t offset = 0;
+    size_t size = 0;
+    int flags = MNT_NOWAIT;
+    int exported = FALSE;
+    int res = 0;
+
+    (void) module;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|si$OOOsOOOKKO", keywords,
+                                     &format, &flags, &otimeout, &labels, &fields, &ns, &into,
+                                     &include, &exclude, &require_flags, &exclude_flags, &prefix))
+        return NULL;
+    if (into == Py_None)
+        into = NULL;
+    if (into && !PyByteArray_Check(into))
+    {
+        PyErr_SetString(PyExc_TypeError, "into must be a bytearray");
+        return NULL;
+    }
+    if (!parse_timeout(otimeout, &timeout))
+        return NULL;
+    if (!parse_render(&spec, format, labels, fields, ns))
+        return NULL;
+    if (!parse_filter(&filter, include, exclude, require_flags, exclude_flags, prefix))
+    {
+        render_spec_exit(&spec);
+        return NULL;
+    }
+    if (!(job = job_new(JOB_GETFSSTAT)))
+        goto exit;
+    if (!job_filter(job, &filter))
+        goto exit;
+    job->flags = flags;
+    if (!job_run(job, timeout))
+    {
+        job = NULL; /* freed by job_run() */
+        goto exit;
+    }
+    job->result = filter_apply(&filter, job->pbuf, job->result, TRUE);
+
+    Py_BEGIN_ALLOW_THREADS
+    if (spec.format == RENDER_PROMETHEUS)
+        job->result = render_topmost(job->pbuf, job->result);
+    if (job->result >= 0)
+        size = render_table(&spec, job->pbuf, job->result, NULL);
+    Py_END_ALLOW_THREADS
+    if (job->result < 0 || size > (size_t) PY_SSIZE_T_MAX)
+    {
+        PyErr_NoMemory();
+        goto exit;
+    }
+
+    if (!into)
+    {
+        if (!(result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) size)))
+            goto exit;
+        data = PyBytes_AS_STRING(result);
+    }
+    else
+    {
+        /* appended; the export keeps the bytearray from resizing meanwhile */
+        Py_BEGIN_CRITICAL_SECTION(into);
+        offset = PyByteArray_GET_SIZE(into);
+        if ((size_t) (PY_SSIZE_T_MAX - offset) < size)
+        {
+            PyErr_NoMemory();
+            res = -1;
+        }
+        else if ((res = PyByteArray_Resize(into, offset + (Py_ssize_t) size)) == 0)
+            res = PyObject_GetBuffer(into, &view, PyBUF_WRITABLE);
+        Py_END_CRITICAL_SECTION();
+        if (res < 0)
+            goto exit;
+        exported = TRUE;
+        data = (char *) view.buf + offset;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    render_table(&spec, job->pbuf, job->result, data);
+    Py_END_ALLOW_THREADS
+    if (into)
+        result = PyLong_FromSize_t(size);
+
+exit:
+    if (exported)
+        PyBuffer_Release(&view);
+    if (job)
+        job_free(job);
+    filter_exit(&filter);
+    render_spec_exit(&spec);
+    return result;
+
+#else  /* !HAVE_GETFSSTAT */
+
+    (void) module;
+    (void) args;
+    (void) kwargs;
+
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
+
+#endif /* !HAVE_GETFSSTAT */
+}
+
+static PyObject *
+method_iter_mounts(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+#if HAVE_GETFSSTAT
+
+    static char *keywords[] = {
+        "flags", "chunk", "lazy", "fields",
+        "include_types", "exclude_types", "require_flags", "exclude_flags", "path_prefix",
+        "deadline", NULL
+    };
+
+    statfs_state *st = module_state(module);
+    mount_iterator_object *self = NULL;
+    PyObject *odeadline = NULL;
+    PyObject *ofields = NULL;
+    PyObject *include = NULL;
+    PyObject *exclude = NULL;
+    PyObject *prefix = NULL;
+    unsigned long long require_flags = 0;
+    unsigned long long exclude_flags = 0;
+    double deadline = -1.0;
+    int flags = MNT_NOWAIT;
+    int chunk = ITER_CHUNK;
+    int lazy = FALSE;
+    int mcnt = 0;
+#ifdef COMPILE_LINUX
+    ssize_t size = -1;
+    int err = 0;
+    int fd = -1;
+#endif /* COMPILE_LINUX */
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i$ipOOOKKOO", keywords,
+                                     &flags, &chunk, &lazy, &ofields,
+                                     &include, &exclude, &require_flags, &exclude_flags, &prefix,
+                                     &odeadline))
+        return NULL;
+    if (chunk < 1 || chunk > 65536)
+    {
+        PyErr_SetString(PyExc_ValueError, "chunk must be 1 to 65536");
+        return NULL;
+    }
+    if (!parse_deadline(odeadline, &deadline))
+        return NULL;
+    if (!(self = (mount_iterator_object *) PyType_GenericAlloc(st->mount_iterator_type, 0)))
+        return NULL;
+    self->st = st;
+    self->flags = flags;
+    self->lazy = lazy;
+    if (!parse_fields(ofields, &self->proj) ||
+        !parse_filter(&self->filter, include, exclude, require_flags, exclude_flags, prefix))
+        goto error;
+
+#ifdef COMPILE_LINUX
+    (void) mcnt;
+    self->deadline = odeadline ? deadline : REFRESH_DEADLINE;
+    self->chunk = chunk;
+    if (!(self->pbuf = (statfs_t *) malloc(sizeof(statfs_t) * chunk)))
+    {
+        PyErr_NoMemory();
+        goto error;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    if ((fd = linux_open_fd(NULL)) >= 0)
+    {
+        size = linux_read_text(fd, &self->text);
+        err = errno;
+        close(fd);
+        errno = err;
+    }
+    Py_END_ALLOW_THREADS
+    if (fd < 0 || size < 0)
+    {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto error;
+    }
+    self->next = self->text;
+    self->end = self->text + size;
+#else  /* !COMPILE_LINUX */
+    Py_BEGIN_ALLOW_THREADS
+    mcnt = sys_getfsstat(&self->pbuf, flags);
+    Py_END_ALLOW_THREADS
+    if (mcnt < 0)
+    {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto error;
+    }
+    self->chunk = mcnt;
+#endif /* !COMPILE_LINUX */
+    return (PyObject *) self;
+
+error:
+    Py_DecRef((PyObject *) self);
+    return NULL;
 
-    statfs_init(o);
+#else  /* !HAVE_GETFSSTAT */
 
-#define build_statfs_gen_str(n) if (!(o->n = PyUnicode_FromString((const char *)pmnt->f_##n))) goto exit
-#define build_statfs_gen_l(n)   if (!(o->n = PyLong_FromLong((long) pmnt->f_##n))) goto exit
-#define build_statfs_gen_ul(n)  if (!(o->n = PyLong_FromUnsignedLong((unsigned long) pmnt->f_##n))) goto exit
-#define build_statfs_gen_ull(n) if (!(o->n = PyLong_FromUnsignedLongLong((unsigned long long) pmnt->f_##n))) goto exit
+    (void) module;
+    (void) args;
+    (void) kwargs;
 
-    build_statfs_gen_ull(flags);
-    build_statfs_gen_l(owner);
+    PyErr_SetNone(PyExc_NotImplementedError);
+    return NULL;
 
-    {/* f_fsid */
-        if (!(o->fsidv[0] = PyLong_FromLong(pmnt->f_fsid.val[0]))) goto exit;
-        if (!(o->fsidv[1] = PyLong_FromLong(pmnt->f_fsid.val[1]))) goto exit;
-        if (!(o->fsid = PyTuple_New(2))) goto exit;
-        TupleMoveItem(o->fsid, 0, &o->fsidv[0]);
-        TupleMoveItem(o->fsid, 1, &o->fsidv[1]);
-    }
-    build_statfs_gen_ull(type);
+#endif /* !HAVE_GETFSSTAT */
+}
 
-    build_statfs_gen_str(fstypename);
-    build_statfs_gen_str(mntfromname);
-    build_statfs_gen_str(mntonname);
+static PyObject *
+method_mount_generation(PyObject *module, PyObject *args)
+{
+    unsigned long generation = 0;
 
-    build_statfs_gen_ull(iosize);
-    build_statfs_gen_ull(bsize);
-    build_statfs_gen_ull(blocks);
-    build_statfs_gen_ull(bavail);
-    build_statfs_gen_ull(bfree);
+    (void) module;
+    (void) args;
 
-    build_statfs_gen_ull(ffree);
-    build_statfs_gen_ull(files);
+#if HAVE_GETMNTINFO
+    pthread_mutex_lock(&cache_lock);
+    generation = cache_generation;
+    pthread_mutex_unlock(&cache_lock);
+#endif /* HAVE_GETMNTINFO */
+    return PyLong_FromUnsignedLong(generation);
+}
 
-#ifdef COMPILE_FREEBSD
-    build_statfs_gen_ul(version);
-    build_statfs_gen_ul(namemax);
-    build_statfs_gen_str(spare);
-    build_statfs_gen_str(charspare);
-    build_statfs_gen_ull(syncwrites);
-    build_statfs_gen_ull(asyncwrites);
-    build_statfs_gen_ull(syncreads);
-    build_statfs_gen_ull(asyncreads);
-#endif /* COMPILE_FREEBSD */
-#ifdef USE_STATFS_DF32
-    build_statfs_gen_l(otype);
-    build_statfs_gen_l(oflags);
-    build_statfs_gen_l(reserved1);
-    {/* f_reserved2 */
-        if (!(o->reserved2v[0] = PyLong_FromLong(pmnt->f_reserved2[0]))) goto exit;
-        if (!(o->reserved2v[1] = PyLong_FromLong(pmnt->f_reserved2[1]))) goto exit;
-        if (!(o->reserved2 = PyTuple_New(2))) goto exit;
-        TupleMoveItem(o->reserved2, 0, &o->reserved2v[0]);
-        TupleMoveItem(o->reserved2, 1, &o->reserved2v[1]);
-    }
-    build_statfs_gen_l(reserved3);
-    {/* f_reserved4 */
-        for (i = 0; i < 4; ++i)
-            if (!(o->reserved4v[i] = PyLong_FromLong(pmnt->f_reserved4[i])))
-                goto exit;
-        if (!(o->reserved4 = PyTuple_New(4)))
-            goto exit;
-        for (i = 0; i < 4; ++i)
-            TupleMoveItem(o->reserved4, i, &o->reserved4v[i]);
-    }
-#endif /* USE_STATFS_DF32 */
-#ifdef USE_STATFS_DF64
-    build_statfs_gen_ul(flags_ext);
-    build_statfs_gen_ul(fssubtype);
-    {
-        rcnt = (int)(sizeof(pmnt->f_reserved) / sizeof(pmnt->f_reserved[0]));
+static PyObject *
+method_intern_clear(PyObject *module, PyObject *args)
+{
+    (void) args;
 
-        for (i = 0; i < rcnt; ++i)
-            if (!(o->reservedv[i] = PyLong_FromUnsignedLong(pmnt->f_reserved[i])))
-                goto exit;
-        if (!(o->reserved = PyTuple_New(rcnt)))
-            goto exit;
-        for (i = 0; i < rcnt; ++i)
-            TupleMoveItem(o->reserved, i, &o->reservedv[i]);
-    }
-#endif /* USE_STATFS_DF64 */
+    intern_clear(module_state(module));
+    Py_RETURN_NONE;
+}
 
-#undef build_statfs_gen_str
-#undef build_statfs_gen_l
-#undef build_statfs_gen_ul
-#undef build_statfs_gen_ull
+static PyObject *
+method_intern_stats(PyObject *module, PyObject *args)
+{
+    statfs_state *st = module_state(module);
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    Py_ssize_t strings = 0;
+    Py_ssize_t numbers = 0;
+    int i;
 
-    statfs_fix(o);
-    if (!(args = PyTuple_New(STATFS_MEMBERS)))
-        goto exit;
+    (void) args;
 
-#define build_statfs_arg(n) TupleMoveItem(args, (Py_ssize_t) i, &o->n); ++i
-
-    i = 0;
-    build_statfs_arg(version);
-    build_statfs_arg(otype);
-    build_statfs_arg(oflags);
-    build_statfs_arg(flags);
-    build_statfs_arg(flags_ext);
-    build_statfs_arg(owner);
-
-    build_statfs_arg(fsid);
-    build_statfs_arg(type);
-    build_statfs_arg(fssubtype);
-    build_statfs_arg(namemax);
-
-    build_statfs_arg(fstypename);
-    build_statfs_arg(mntfromname);
-    build_statfs_arg(mntonname);
-    build_statfs_arg(spare);
-    build_statfs_arg(charspare);
-
-    build_statfs_arg(iosize);
-    build_statfs_arg(bsize);
-    build_statfs_arg(blocks);
-    build_statfs_arg(bavail);
-    build_statfs_arg(bfree);
-
-    build_statfs_arg(ffree);
-    build_statfs_arg(files);
-
-    build_statfs_arg(syncwrites);
-    build_statfs_arg(asyncwrites);
-    build_statfs_arg(syncreads);
-    build_statfs_arg(asyncreads);
-
-    build_statfs_arg(reserved);
-    build_statfs_arg(reserved1);
-    build_statfs_arg(reserved2);
-    build_statfs_arg(reserved3);
-    build_statfs_arg(reserved4);
-
-    if (i != STATFS_MEMBERS)
-        abort(); /* Bug!! */
-
-#undef build_statfs_arg
-
-    pinfo = PyObject_Call(new_statfs_func, args, NULL);
-exit:
-    statfs_exit(o);
-    return pinfo;
+    pthread_mutex_lock(&st->intern_lock);
+    for (i = 0; i < INTERN_STRINGS; ++i)
+        strings += (st->intern_strings[i].value != NULL);
+    for (i = 0; i < INTERN_NUMBERS; ++i)
+        numbers += (st->intern_numbers[i].value != NULL);
+    hits = st->intern_hits;
+    misses = st->intern_misses;
+    pthread_mutex_unlock(&st->intern_lock);
+    return Py_BuildValue("{sKsKsnsn}", "hits", hits, "misses", misses,
+                         "strings", strings, "numbers", numbers);
 }
 
 static PyObject *
-method_statfs(PyObject *module, PyObject *args, PyObject *kwargs)
+method_mount_source(PyObject *module, PyObject *args, PyObject *kwargs)
 {
-#if HAVE_STATFS
+#ifdef COMPILE_LINUX
 
     static char *keywords[] = { "path", NULL };
 
-    PyObject *name = NULL;
-    statfs_t buf;
+    PyObject *opath = NULL;
+    PyObject *bytes = NULL;
+    PyObject *previous = NULL;
+    const char *path = NULL;
+    char *copy = NULL;
 
     (void) module;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keywords, &name))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", keywords, &opath))
         return NULL;
-    if (!name || !PyUnicode_Check(name))
+    if (opath && opath != Py_None)
     {
-        PyErr_BadArgument();
-        return NULL;
+        if (!(path = parse_path_arg("path", opath, &bytes)))
+            return NULL;
+        /* the default by name is the default: the cache keeps watching it */
+        if (strcmp(path, LINUX_MOUNTINFO) != 0 && !(copy = strdup(path)))
+        {
+            Py_DecRef(bytes);
+            return PyErr_NoMemory();
+        }
+        Py_DecRef(bytes);
     }
-    if (statfs(PyUnicode_AsUTF8AndSize(name, NULL), &buf) < 0)
-        return PyErr_SetFromErrno(PyExc_OSError);
-    return build_statfs(&buf);
 
-#else  /* !HAVE_STATFS */
+    pthread_mutex_lock(&linux_source_lock);
+    previous = linux_source ? PyUnicode_DecodeFSDefault(linux_source) : NewNone();
+    free(linux_source);
+    linux_source = copy;
+    pthread_mutex_unlock(&linux_source_lock);
+
+    /* the cached table came from the other source */
+    pthread_mutex_lock(&cache_lock);
+    cache_drop();
+    pthread_mutex_unlock(&cache_lock);
+    return previous;
+
+#else  /* !COMPILE_LINUX */
 
     (void) module;
     (void) args;
@@ -502,28 +8101,49 @@ method_statfs(PyObject *module, PyObject *args, PyObject *kwargs)
     PyErr_SetNone(PyExc_NotImplementedError);
     return NULL;
 
-#endif /* !HAVE_STATFS */
+#endif /* !COMPILE_LINUX */
 }
 
+/* parse mountinfo text without statfs(), for the parse benchmark */
 static PyObject *
-method_fstatfs(PyObject *module, PyObject *args, PyObject *kwargs)
+method_parse_mountinfo(PyObject *module, PyObject *args, PyObject *kwargs)
 {
-#if HAVE_STATFS
+#ifdef COMPILE_LINUX
 
-    static char *keywords[] = { "fd", NULL };
+    static char *keywords[] = { "data", "simd", NULL };
 
-    int fd = -1;
-    statfs_t buf;
+    Py_buffer data = { 0 };
+    linux_scan_fn scan = NULL;
+    statfs_t *ptab = NULL;
+    char *text = NULL;
+    int simd = TRUE;
+    int cnt = 0;
 
     (void) module;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", keywords, &fd))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|$p", keywords, &data, &simd))
         return NULL;
-    if (fstatfs(fd, &buf) < 0)
-        return PyErr_SetFromErrno(PyExc_OSError);
-    return build_statfs(&buf);
+    if (!(text = (char *) malloc((size_t) data.len + 1)))
+    {
+        PyBuffer_Release(&data);
+        return PyErr_NoMemory();
+    }
+    memcpy(text, data.buf, (size_t) data.len);
+    text[data.len] = '\0';
+    scan = simd ? linux_scan : linux_scan_scalar;
+
+    Py_BEGIN_ALLOW_THREADS
+    cnt = linux_parse_text(text, (size_t) data.len, scan, &ptab);
+    Py_END_ALLOW_THREADS
+
+    free(ptab);
+    free(text);
+    PyBuffer_Release(&data);
+    if (cnt < 0)
+        return PyErr_NoMemory();
+    return PyLong_FromLong(cnt);
 
-#else  /* !HAVE_FSTATFS */
+#else  /* !COMPILE_LINUX */
 
     (void) module;
     (void) args;
@@ -532,148 +8152,132 @@ method_fstatfs(PyObject *module, PyObject *args, PyObject *kwargs)
     PyErr_SetNone(PyExc_NotImplementedError);
     return NULL;
 
-#endif /* !HAVE_FSTATFS */
+#endif /* !COMPILE_LINUX */
 }
 
+/* {mount namespace inode: lowest pid in it}, one entry per namespace */
 static PyObject *
-method_getfsstat(PyObject *module, PyObject *args, PyObject *kwargs)
+method_mount_namespaces(PyObject *module, PyObject *args)
 {
-#if HAVE_GETFSSTAT
-    static char *keywords[] = { "flags", NULL };
-
-    statfs_t *pbuf = NULL;
-    PyObject *plist = NULL;
-    PyObject *pinfo = NULL;
-    int success = FALSE;
-    int flags = MNT_NOWAIT;
-    int bufsize = 0;
-    int mcnt = 0;
-    int i = 0;
+#ifdef COMPILE_LINUX
+
+    struct dirent *entry = NULL;
+    struct stat st;
+    PyObject *dict = NULL;
+    PyObject *key = NULL;
+    PyObject *value = NULL;
+    PyObject *known = NULL;
+    char path[64];
+    char *end = NULL;
+    DIR *dir = NULL;
+    long pid = 0;
+    int err = 0;
 
     (void) module;
+    (void) args;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", keywords, &flags))
+    if (!(dict = PyDict_New()))
         return NULL;
-
-    mcnt = getfsstat(NULL, 0, flags);
-    if (mcnt < 0)
-        return PyErr_SetFromErrno(PyExc_OSError);
-    bufsize = (int) (sizeof(statfs_t) * mcnt);
-    pbuf = (statfs_t *) malloc(bufsize);
-    if (!pbuf)
-        return PyErr_NoMemory();
-    mcnt = getfsstat(pbuf, bufsize, flags);
-    if (mcnt < 0)
+    if (!(dir = opendir("/proc")))
     {
-        PyErr_SetFromErrno(PyExc_OSError);
-        free(pbuf);
-        /* pbuf = NULL; */
-        return NULL;
+        Py_DecRef(dict);
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, "/proc");
     }
-
-    if ((plist = PyList_New(mcnt)))
+    for (;;)
     {
-        for (i = 0; i < mcnt; ++i)
+        Py_BEGIN_ALLOW_THREADS
+        errno = 0;
+        if ((entry = readdir(dir)))
         {
-            if (!(pinfo = build_statfs(pbuf + i)))
-                break;
-            ListMoveItem(plist, (Py_ssize_t)i, &pinfo);
+            pid = strtol(entry->d_name, &end, 10);
+            if (*end || pid <= 0)
+                err = -1; /* not a process */
+            else
+            {
+                snprintf(path, sizeof(path), "/proc/%ld/ns/mnt", pid);
+                err = stat(path, &st); /* gone, or not ours: skipped */
+            }
         }
-    }
-    success = (i == mcnt);
+        Py_END_ALLOW_THREADS
 
-    if (!success)
-    {
-        Py_XDECREF(plist);
-        plist = NULL;
+        if (!entry)
+            break;
+        if (err < 0)
+            continue;
+        if (!(key = PyLong_FromUnsignedLongLong((unsigned long long) st.st_ino)))
+            goto error;
+        known = PyDict_GetItemWithError(dict, key);
+        if (!known && PyErr_Occurred())
+            goto error;
+        if (!known || PyLong_AsLong(known) > pid)
+        {
+            if (!(value = PyLong_FromLong(pid)) || PyDict_SetItem(dict, key, value) < 0)
+                goto error;
+            Py_CLEAR(value);
+        }
+        Py_CLEAR(key);
     }
-    free(pbuf);
-    /* pbuf = NULL; */
-    return plist;
+    closedir(dir);
+    return dict;
 
-#else  /* !HAVE_GETFSSTAT */
+error:
+    Py_XDECREF(key);
+    Py_XDECREF(value);
+    Py_DecRef(dict);
+    closedir(dir);
+    return NULL;
+
+#else  /* !COMPILE_LINUX */
 
     (void) module;
     (void) args;
-    (void) kwargs;
 
     PyErr_SetNone(PyExc_NotImplementedError);
     return NULL;
 
-#endif /* !HAVE_GETFSSTAT */
+#endif /* !COMPILE_LINUX */
 }
 
 static PyObject *
-method_getmntinfo(PyObject *module, PyObject *args, PyObject *kwargs)
+method_stuck_threads(PyObject *module, PyObject *args)
 {
-#if HAVE_GETMNTINFO
-
-    static char *keywords[] = { "flags", NULL };
-
-    statfs_t *pbuf = NULL;
-    PyObject *plist = NULL;
-    PyObject *pinfo = NULL;
-    int success = FALSE;
-    int flags = MNT_NOWAIT;
-    int mcnt = 0;
-    int i = 0;
-
-    (void) module;
-
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", keywords, &flags))
-        return NULL;
-
-#ifdef HAVE_GETMNTINFO_R_NP
-    mcnt = getmntinfo_r_np(&pbuf, flags);
-#else  /* !HAVE_GETMNTINFO_R_NP */
-    mcnt = getmntinfo(&pbuf, flags);
-#endif /* !HAVE_GETMNTINFO_R_NP */
-    if (mcnt < 0)
-        return PyErr_SetFromErrno(PyExc_OSError);
-    if ((plist = PyList_New(mcnt)))
-    {
-        for (i = 0; i < mcnt; ++i)
-        {
-            if (!(pinfo = build_statfs(pbuf + i)))
-                break;
-            ListMoveItem(plist, (Py_ssize_t)i, &pinfo);
-        }
-    }
-    success = (i == mcnt);
-#ifdef HAVE_GETMNTINFO_R_NP
-    if (pbuf)
-    {
-        free(pbuf);
-        pbuf = NULL;
-    }
-#endif /* HAVE_GETMNTINFO_R_NP */
-
-    if (!success)
-    {
-        Py_XDECREF(plist);
-        plist = NULL;
-    }
-    return plist;
-
-#else /* !HAVE_GETMNTINFO */
+    int stuck = 0;
 
     (void) module;
     (void) args;
-    (void) kwargs;
 
-    PyErr_SetNone(PyExc_NotImplementedError);
-    return NULL;
-
-#endif /* !HAVE_GETMNTINFO */
+    pthread_mutex_lock(&job_lock);
+    stuck = job_stuck;
+    pthread_mutex_unlock(&job_lock);
+#ifdef COMPILE_LINUX
+    stuck += __atomic_load_n(&refresh_lost, __ATOMIC_RELAXED);
+#endif /* COMPILE_LINUX */
+    return PyLong_FromLong(stuck);
 }
 
 /*
  *
  */
 
+static PyStructSequence_Field statfs_fields[STATFS_MEMBERS + 1];
+
+static PyStructSequence_Desc statfs_desc = {
+    .name = "statfs.statfs_result", /* statfs() is the function */
+    .doc = "struct statfs",
+    .fields = statfs_fields,
+    .n_in_sequence = STATFS_MEMBERS,
+};
+
+static PyMethodDef statfs_record_methods[] = {
+    { "_asdict", (PyCFunction) statfs_asdict, METH_NOARGS, "_asdict() -> dict\n" },
+    {NULL, NULL, 0, NULL}, /* end */
+};
+
 static int
-prepare_statfs(PyObject *module, PyObject *namedtuple)
+prepare_statfs(PyObject *module)
 {
+    statfs_state *st = module_state(module);
+    PyMethodDef *pdef = NULL;
     PyObject *name = NULL;
     PyObject *item = NULL;
     PyObject *indices = NULL;
@@ -689,6 +8293,8 @@ prepare_statfs(PyObject *module, PyObject *namedtuple)
 
 #if defined(COMPILE_FREEBSD)
     model = "FreeBSD";
+#elif defined(COMPILE_LINUX)
+    model = "Linux";
 #elif defined(USE_STATFS_DF64)
     model = "Darwin64";
 #elif defined(USE_STATFS_DF32)
@@ -711,11 +8317,26 @@ prepare_statfs(PyObject *module, PyObject *namedtuple)
             goto error;
         TupleMoveItem(members, (Py_ssize_t) i, &item);
     }
-    if (!(name = PyUnicode_FromString("statfs")))
+    if (!(st->statfs_type = PyStructSequence_NewType(&statfs_desc)))
+        goto error;
+    if (PyObject_SetAttrString((PyObject *) st->statfs_type, "_fields", members) < 0)
+        goto error;
+    for (pdef = statfs_record_methods; pdef->ml_name; ++pdef)
+    {
+        if (!(item = PyDescr_NewMethod(st->statfs_type, pdef)))
+            goto error;
+        if (PyObject_SetAttrString((PyObject *) st->statfs_type, pdef->ml_name, item) < 0)
+            goto error;
+        DecRelease(&item);
+    }
+    item = (PyObject *) st->statfs_type;
+    Py_IncRef(item);
+    if (ModuleAddRelease(module, "statfs_result", &item) < 0)
         goto error;
-    new_statfs_func = PyObject_CallFunctionObjArgs(namedtuple, name, members, NULL);
-    DecRelease(&name);
-    if (!new_statfs_func)
+    if (!(st->lazy_statfs_type = (PyTypeObject *)
+          PyType_FromModuleAndSpec(module, &lazy_statfs_spec, NULL)))
+        goto error;
+    if (PyObject_SetAttrString((PyObject *) st->lazy_statfs_type, "_fields", members) < 0)
         goto error;
     if (ModuleAddRelease(module, "members", &members) < 0)
         goto error;
@@ -742,6 +8363,10 @@ prepare_statfs(PyObject *module, PyObject *namedtuple)
             else if (c == 'd')
                 break;
 #endif /* DF32 */
+#ifdef COMPILE_LINUX
+            else if (c == 'L')
+                break;
+#endif /* LINUX */
         }
         if (c)
         {
@@ -773,29 +8398,109 @@ error:
     return FALSE;
 }
 
+/* a type of this module, also added to it as name */
 static int
-prepare_namedtuple(PyObject *module)
+prepare_class(PyObject *module, const char *name, PyType_Spec *spec, PyTypeObject **ptype)
 {
-    PyObject *collections = NULL;
-    PyObject *namedtuple = NULL;
-    int res = 0;
+    PyObject *type = NULL;
+
+    if (!(*ptype = (PyTypeObject *) PyType_FromModuleAndSpec(module, spec, NULL)))
+        return FALSE;
+    type = (PyObject *) *ptype;
+    Py_IncRef(type);
+    if (ModuleAddRelease(module, name, &type) < 0)
+    {
+        Py_DecRef(type);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int
+prepare_watcher(PyObject *module)
+{
+    statfs_state *st = module_state(module);
 
-    collections = PyImport_ImportModule("collections");
-    if (!collections)
+    if (!(st->mount_changes_type = PyStructSequence_NewType(&mount_changes_desc)))
         return FALSE;
-    namedtuple = PyObject_GetAttrString(collections, "namedtuple");
-    Py_DecRef(collections);
-    if (!namedtuple)
+    if (!prepare_class(module, "MountWatcher", &mount_watcher_spec, &st->mount_watcher_type))
         return FALSE;
-    res = prepare_statfs(module, namedtuple);
-    Py_DecRef(namedtuple);
-    return res;
+    if (!(st->snapshot_changes_type = PyStructSequence_NewType(&snapshot_changes_desc)))
+        return FALSE;
+    if (!prepare_class(module, "Snapshot", &snapshot_spec, &st->snapshot_type))
+        return FALSE;
+    if (!prepare_class(module, "Poller", &poller_spec, &st->poller_type))
+        return FALSE;
+    if (!prepare_class(module, "MountIndex", &mount_index_spec, &st->mount_index_type))
+        return FALSE;
+    if (!prepare_class(module, "Sampler", &sampler_spec, &st->sampler_type))
+        return FALSE;
+    return TRUE;
+}
+
+static int
+prepare_types(PyObject *module)
+{
+    statfs_state *st = module_state(module);
+    PyObject *type = NULL;
+
+    if (!(st->capacity_type = PyStructSequence_NewType(&capacity_desc)))
+        return FALSE;
+    type = (PyObject *) st->capacity_type;
+    Py_IncRef(type);
+    if (ModuleAddRelease(module, "capacity_result", &type) < 0)
+    {
+        Py_DecRef(type);
+        return FALSE;
+    }
+    if (!(st->mount_iterator_type = (PyTypeObject *)
+          PyType_FromModuleAndSpec(module, &mount_iterator_spec, NULL)))
+        return FALSE;
+    return TRUE;
+}
+
+/* process-wide tables, filled once whichever interpreter imports first */
+static pthread_once_t prepare_once = PTHREAD_ONCE_INIT;
+
+static void
+prepare_tables(void)
+{
+    int i;
+
+    for (i = 0; i < STATFS_MEMBERS; ++i)
+    {
+        statfs_fields[i].name = statfs_member[i][0];
+        statfs_fields[i].doc = NULL;
+        lazy_statfs_getset[i].name = statfs_member[i][0];
+        lazy_statfs_getset[i].get = (getter) lazy_statfs_get;
+        lazy_statfs_getset[i].closure = (void *) (intptr_t) i;
+    }
+    prepare_format(statfs_record_fields, statfs_record_format, sizeof(statfs_record_format));
+    prepare_format(sample_record_fields, sample_record_format, sizeof(sample_record_format));
+#ifdef COMPILE_LINUX
+    linux_scan_init();
+#endif /* COMPILE_LINUX */
 }
 
 static int
 prepare_module(PyObject *module)
 {
-    if (!prepare_namedtuple(module)) return FALSE;
+    statfs_state *st = module_state(module);
+
+    pthread_mutex_init(&st->intern_lock, NULL);
+    pthread_mutex_init(&st->list_lock, NULL);
+    st->locked = TRUE;
+    pthread_once(&prepare_once, prepare_tables);
+
+    if (!prepare_statfs(module)) return FALSE;
+    if (!prepare_record(module)) return FALSE;
+    if (!prepare_watcher(module)) return FALSE;
+    if (!prepare_types(module)) return FALSE;
+
+    /**/
+
+    if (PyModule_AddIntMacro(module, MAX_STUCK_THREADS) < 0) return FALSE;
+    if (PyModule_AddIntMacro(module, MAX_BATCH_WORKERS) < 0) return FALSE;
 
     /**/
 
@@ -825,6 +8530,7 @@ prepare_module(PyObject *module)
     if (PyModule_AddIntMacro(module, MNT_EXKERB) < 0) return FALSE; /* FBSD */
 
     if (PyModule_AddIntMacro(module, MNT_LOCAL) < 0) return FALSE;
+    if (PyModule_AddIntMacro(module, MNT_STALE) < 0) return FALSE;    /* LINUX */
     if (PyModule_AddIntMacro(module, MNT_QUOTA) < 0) return FALSE;
     if (PyModule_AddIntMacro(module, MNT_ROOTFS) < 0) return FALSE;
     if (PyModule_AddIntMacro(module, MNT_DOVOLFS) < 0) return FALSE; /* DARWIN */
@@ -883,55 +8589,208 @@ prepare_module(PyObject *module)
     return TRUE;
 }
 
+static int
+exec_module(PyObject *module)
+{
+    return prepare_module(module) ? 0 : -1;
+}
+
 /*
- *
+ * Module
  */
+
+static int
+traverse_module(PyObject *module, visitproc visit, void *arg)
+{
+    statfs_state *st = module_state(module);
+    int i;
+
+    Py_VISIT(st->statfs_type);
+    Py_VISIT(st->lazy_statfs_type);
+    Py_VISIT(st->statfs_buffer_type);
+    Py_VISIT(st->mount_watcher_type);
+    Py_VISIT(st->mount_changes_type);
+    Py_VISIT(st->snapshot_type);
+    Py_VISIT(st->snapshot_changes_type);
+    Py_VISIT(st->poller_type);
+    Py_VISIT(st->mount_index_type);
+    Py_VISIT(st->capacity_type);
+    Py_VISIT(st->sampler_type);
+    Py_VISIT(st->mount_iterator_type);
+    for (i = 0; i < INTERN_STRINGS; ++i)
+        Py_VISIT(st->intern_strings[i].value);
+    for (i = 0; i < INTERN_NUMBERS; ++i)
+        Py_VISIT(st->intern_numbers[i].value);
+    Py_VISIT(st->cache_list);
+    return 0;
+}
+
+static int
+clear_module(PyObject *module)
+{
+    statfs_state *st = module_state(module);
+
+    Py_CLEAR(st->statfs_type);
+    Py_CLEAR(st->lazy_statfs_type);
+    Py_CLEAR(st->statfs_buffer_type);
+    Py_CLEAR(st->mount_watcher_type);
+    Py_CLEAR(st->mount_changes_type);
+    Py_CLEAR(st->snapshot_type);
+    Py_CLEAR(st->snapshot_changes_type);
+    Py_CLEAR(st->poller_type);
+    Py_CLEAR(st->mount_index_type);
+    Py_CLEAR(st->capacity_type);
+    Py_CLEAR(st->sampler_type);
+    Py_CLEAR(st->mount_iterator_type);
+    if (st->locked)
+        intern_clear(st);
+    Py_CLEAR(st->cache_list);
+    return 0;
+}
+
+static void
+free_module(void *module)
+{
+    statfs_state *st = module_state((PyObject *) module);
+
+    clear_module((PyObject *) module);
+    if (st->locked)
+    {
+        pthread_mutex_destroy(&st->intern_lock);
+        pthread_mutex_destroy(&st->list_lock);
+        st->locked = FALSE;
+    }
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-function-type"
 
 static PyMethodDef statfs_methods[] = {
     {
-        "statfs", (PyCFunction) method_statfs, METH_VARARGS | METH_KEYWORDS,
-        "statfs(path: str) -> statfs\n"
+        "statfs", (PyCFunction) method_statfs, METH_FASTCALL | METH_KEYWORDS,
+        "statfs(path: str | bytes | os.PathLike, *, timeout: float = None,\n"
+        "       lazy: bool = False, fields: tuple = None,\n"
+        "       dir_fd: int = None) -> statfs\n"
+    },
+    {
+        "fstatfs", (PyCFunction) method_fstatfs, METH_FASTCALL | METH_KEYWORDS,
+        "fstatfs(fd: int, *, timeout: float = None, lazy: bool = False,\n"
+        "        fields: tuple = None) -> statfs\n"
+    },
+    {
+        "getfsstat", (PyCFunction) method_getfsstat, METH_FASTCALL | METH_KEYWORDS,
+        "getfsstat(flags: int = MNT_NOWAIT, *, timeout: float = None,\n"
+        "          lazy: bool = False, as_buffer: bool = False,\n"
+        "          fields: tuple = None, include_types: tuple = None,\n"
+        "          exclude_types: tuple = None, require_flags: int = 0,\n"
+        "          exclude_flags: int = 0, path_prefix: str = None,\n"
+        "          deadline: float = 1.0) -> list\n"
+    },
+    {
+        "getmntinfo", (PyCFunction) method_getmntinfo, METH_FASTCALL | METH_KEYWORDS,
+        "getmntinfo(flags: int = MNT_NOWAIT, *, timeout: float = None,\n"
+        "           lazy: bool = False, as_buffer: bool = False,\n"
+        "           cached: bool = False, fields: tuple = None,\n"
+        "           include_types: tuple = None, exclude_types: tuple = None,\n"
+        "           require_flags: int = 0, exclude_flags: int = 0,\n"
+        "           path_prefix: str = None, pid: int = None,\n"
+        "           root: str | bytes | os.PathLike = None,\n"
+        "           source: str | bytes | os.PathLike = None) -> list\n"
+    },
+    {
+        "capacity", (PyCFunction) method_capacity, METH_VARARGS | METH_KEYWORDS,
+        "capacity(flags: int = MNT_NOWAIT, *, timeout: float = None, top: int = 0,\n"
+        "         by: str = 'bytes', include_types: tuple = None,\n"
+        "         exclude_types: tuple = None, require_flags: int = 0,\n"
+        "         exclude_flags: int = 0, path_prefix: str = None) -> list\n"
+    },
+    {
+        "render", (PyCFunction) method_render, METH_VARARGS | METH_KEYWORDS,
+        "render(format: str = 'prometheus', flags: int = MNT_NOWAIT, *,\n"
+        "       timeout: float = None, labels: dict = None, fields: tuple = None,\n"
+        "       namespace: str = 'statfs', into: bytearray = None,\n"
+        "       include_types: tuple = None, exclude_types: tuple = None,\n"
+        "       require_flags: int = 0, exclude_flags: int = 0,\n"
+        "       path_prefix: str = None) -> bytes\n"
+    },
+    {
+        "iter_mounts", (PyCFunction) method_iter_mounts, METH_VARARGS | METH_KEYWORDS,
+        "iter_mounts(flags: int = MNT_NOWAIT, *, chunk: int = 64, lazy: bool = False,\n"
+        "            fields: tuple = None, include_types: tuple = None,\n"
+        "            exclude_types: tuple = None, require_flags: int = 0,\n"
+        "            exclude_flags: int = 0, path_prefix: str = None,\n"
+        "            deadline: float = 1.0) -> iterator\n"
+    },
+    {
+        "mount_generation", (PyCFunction) method_mount_generation, METH_NOARGS,
+        "mount_generation() -> int\n"
+    },
+    {
+        "statfs_many", (PyCFunction) method_statfs_many, METH_VARARGS | METH_KEYWORDS,
+        "statfs_many(paths: iterable, *, workers: int = 4, lazy: bool = False,\n"
+        "            fields: tuple = None) -> list\n"
+    },
+    {
+        "fstatfs_many", (PyCFunction) method_fstatfs_many, METH_VARARGS | METH_KEYWORDS,
+        "fstatfs_many(fds: iterable, *, workers: int = 4, lazy: bool = False,\n"
+        "             fields: tuple = None) -> list\n"
+    },
+    {
+        "intern_clear", (PyCFunction) method_intern_clear, METH_NOARGS,
+        "intern_clear() -> None\n"
+    },
+    {
+        "intern_stats", (PyCFunction) method_intern_stats, METH_NOARGS,
+        "intern_stats() -> dict\n"
+    },
+    {
+        "stuck_threads", (PyCFunction) method_stuck_threads, METH_NOARGS,
+        "stuck_threads() -> int\n"
     },
     {
-        "fstatfs", (PyCFunction) method_fstatfs, METH_VARARGS | METH_KEYWORDS,
-        "fstatfs(fd: int) -> statfs\n"
+        "mount_namespaces", (PyCFunction) method_mount_namespaces, METH_NOARGS,
+        "mount_namespaces() -> dict\n"
     },
     {
-        "getfsstat", (PyCFunction) method_getfsstat, METH_VARARGS | METH_KEYWORDS,
-        "getfsstat(flags: int = MNT_NOWAIT) -> list\n"
+        "mount_source", (PyCFunction) method_mount_source, METH_VARARGS | METH_KEYWORDS,
+        "mount_source(path: str | bytes | os.PathLike = None) -> str | None\n"
     },
     {
-        "getmntinfo", (PyCFunction) method_getmntinfo, METH_VARARGS | METH_KEYWORDS,
-        "getmntinfo(flags: int = MNT_NOWAIT) -> list\n"
+        "_parse_mountinfo", (PyCFunction) method_parse_mountinfo, METH_VARARGS | METH_KEYWORDS,
+        "_parse_mountinfo(data: bytes, *, simd: bool = True) -> int\n"
     },
     {NULL, NULL, 0, NULL}, /* end */
 };
 
 #pragma GCC diagnostic pop
 
+static PyModuleDef_Slot statfs_slots[] = {
+    { Py_mod_exec, (void *) exec_module },
+#ifdef Py_mod_multiple_interpreters
+    { Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif /* >= 3.12 */
+#ifdef Py_mod_gil
+    { Py_mod_gil, Py_MOD_GIL_NOT_USED },
+#endif /* >= 3.13 */
+    { 0, NULL },
+};
+
 static PyModuleDef statfs_def = {
     PyModuleDef_HEAD_INIT,
     .m_name = "statfs",
     .m_doc = NULL,
-    .m_size = -1,
+    .m_size = sizeof(statfs_state),
     .m_methods = statfs_methods,
+    .m_slots = statfs_slots,
+    .m_traverse = traverse_module,
+    .m_clear = clear_module,
+    .m_free = free_module,
 };
 
 PyMODINIT_FUNC
 PyInit_statfs(void)
 {
-    PyObject *module = NULL;
-
-    if (!(module = PyModule_Create(&statfs_def)))
-        return NULL;
-    if (!prepare_module(module))
-    {
-        Py_DecRef(module);
-        module = NULL;
-    }
-    return module;
+    return PyModuleDef_Init(&statfs_def);
 }
 
 /*